@@ -0,0 +1,96 @@
+/**
+ * @file AccumFilm.cpp
+ * @author
+ * @brief Contains the implementation of the accumulation film
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+
+#include "AccumFilm.hpp"
+
+using namespace std;
+
+void AccumFilm::reset(int width, int height, int tileSz)
+{
+	imgWidth = width;
+	imgHeight = height;
+	rgb.assign(3*width*height, 0.0);
+	lumSq.assign(width*height, 0.0);
+	weight.assign(width*height, 0.0);
+	tileSize = max(1, tileSz);
+	tilesX = (width + tileSize - 1)/tileSize;
+	int tilesY = (height + tileSize - 1)/tileSize;
+	dirty = vector<atomic<char>>(tilesX*tilesY);
+	for (atomic<char>& d : dirty)
+		d.store(0);
+}
+
+vector<Tile> AccumFilm::takeDirty()
+{
+	vector<Tile> tiles;
+	for (size_t i = 0; i < dirty.size(); i++)
+	{
+		if (!dirty[i].exchange(0, memory_order_relaxed))
+			continue;
+		int x = int(i%tilesX)*tileSize, y = int(i/tilesX)*tileSize;
+		tiles.push_back({x, y, min(x + tileSize, imgWidth), min(y + tileSize, imgHeight)});
+	}
+	return tiles;
+}
+
+vec3 AccumFilm::mean(int pix) const
+{
+	double w = weight[pix];
+	if (w <= 0)
+		return vec3(0.0f);
+	return vec3(float(rgb[3*pix]/w), float(rgb[3*pix + 1]/w), float(rgb[3*pix + 2]/w));
+}
+
+double AccumFilm::variance(int pix) const
+{
+	double w = weight[pix];
+	if (w <= 1)
+		return 0;
+	const double* sum = &rgb[3*pix];
+	double lum = (0.299*sum[0] + 0.587*sum[1] + 0.114*sum[2])/w;
+	return max(0.0, (lumSq[pix] - w*lum*lum)/(w - 1));
+}
+
+void AccumFilm::resolve(vec3* img) const
+{
+	for (int i = 0; i < imgWidth*imgHeight; i++)
+		img[i] = mean(i);
+}
+
+void AccumFilm::resolve(vec4* img) const
+{
+	for (int y = 0; y < imgHeight; y++)
+		resolveRow(0, imgWidth, y, img);
+}
+
+void AccumFilm::resolveRow(int x0, int x1, int y, vec4* img) const
+{
+	for (int i = y*imgWidth + x0; i < y*imgWidth + x1; i++)
+		img[i] = vec4(mean(i), 1.0f);
+}
+
+void AccumFilm::resolveRow(int x0, int x1, int y, void* img, int format) const
+{
+	/* The means are packed a short run at a time from the stack */
+	const int run = 64;
+	vec4 means[run];
+	char* dst = (char*)img + (size_t(y)*imgWidth + x0)*displayPixelSize(format);
+	for (int x = x0; x < x1; x += run)
+	{
+		int n = min(run, x1 - x);
+		for (int i = 0; i < n; i++)
+			means[i] = vec4(mean(y*imgWidth + x + i), 1.0f);
+		packDisplay(means, dst, n, format);
+		dst += n*displayPixelSize(format);
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+/**
+ * @file AccumFilm.hpp
+ * @author
+ * @brief Contains the film which progressive renders accumulate their frames into
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <atomic>
+#include <vector>
+
+#include "DisplayFormat.hpp"
+#include "MltPixel.hpp"
+#include "ThreadPool.hpp"
+
+/**
+ * @brief Struct for an RGB film of imgWidth*imgHeight pixels, bottom row first, holding
+ * double precision weighted sums of every estimate added to a pixel. Unlike blending the
+ * frames into a float target, adding a frame to a sum of millions loses nothing, so long
+ * renders keep converging. Each pixel keeps its own weight, so pixels may receive
+ * different numbers of frames. A pixel may only be added to by one thread at a time.
+ * Tiles which received estimates since the last takeDirty() are flagged, so that the
+ * display only needs to upload those.
+ *
+ */
+struct AccumFilm
+{
+	int imgWidth = 0;
+	int imgHeight = 0;
+
+	/* Weighted RGB sums, three per pixel */
+	std::vector<double> rgb;
+	/* Weighted sums of the squared luminance, for the variance of the estimates */
+	std::vector<double> lumSq;
+	/* Sum of the weights of the estimates of every pixel */
+	std::vector<double> weight;
+
+	/* Side of the square dirty tracking tiles, and the tiles changed since the last takeDirty() */
+	int tileSize = TILE_SIZE;
+	int tilesX = 0;
+	std::vector<std::atomic<char>> dirty;
+
+	/**
+	 * @brief Resizes the film and clears it to black
+	 *
+	 * @param width Width of the image
+	 * @param height Height of the image
+	 * @param tileSz Side of the dirty tracking tiles
+	 */
+	void reset(int width, int height, int tileSz = TILE_SIZE);
+
+	/**
+	 * @brief Adds an estimate of the pixel's color
+	 *
+	 * @param pix Index of the pixel
+	 * @param c Estimate
+	 * @param w Weight of the estimate
+	 */
+	void add(int pix, vec3 c, float w = 1.0f)
+	{
+		double* sum = &rgb[3*pix];
+		double lum = 0.299*c.x + 0.587*c.y + 0.114*c.z;
+		sum[0] += double(w)*c.x;
+		sum[1] += double(w)*c.y;
+		sum[2] += double(w)*c.z;
+		lumSq[pix] += w*lum*lum;
+		weight[pix] += w;
+		int y = pix/imgWidth, x = pix - y*imgWidth;
+		dirty[(y/tileSize)*tilesX + x/tileSize].store(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * @brief Returns the tiles changed since the last call and clears their flags. Must
+	 * not run while estimates are being added.
+	 *
+	 */
+	std::vector<Tile> takeDirty();
+
+	/**
+	 * @brief Returns the weighted mean of the pixel, black before its first estimate
+	 *
+	 */
+	vec3 mean(int pix) const;
+
+	/**
+	 * @brief Returns the variance of a single estimate's luminance, counting the weights
+	 * as numbers of estimates
+	 *
+	 */
+	double variance(int pix) const;
+
+	/**
+	 * @brief Writes the mean of every pixel, bottom row first
+	 *
+	 * @param img Image of imgWidth*imgHeight pixels
+	 */
+	void resolve(vec3* img) const;
+
+	/**
+	 * @brief Writes the mean of every pixel with alpha 1, ready to upload as a texture
+	 *
+	 * @param img Image of imgWidth*imgHeight pixels
+	 */
+	void resolve(vec4* img) const;
+
+	/**
+	 * @brief Writes the mean of the pixels [x0, x1) of row y with alpha 1, so that the
+	 * thread which just rendered them can publish them
+	 *
+	 * @param img Image of imgWidth*imgHeight pixels
+	 */
+	void resolveRow(int x0, int x1, int y, vec4* img) const;
+
+	/**
+	 * @brief Writes the mean of the pixels [x0, x1) of row y in a packed display format
+	 *
+	 * @param img Image of imgWidth*imgHeight pixels of displayPixelSize(format) bytes
+	 * @param format One of the DISPLAY_ formats
+	 */
+	void resolveRow(int x0, int x1, int y, void* img, int format) const;
+};
@@ -0,0 +1,69 @@
+/**
+ * @file AdaptiveSampler.cpp
+ * @author
+ * @brief Contains the implementation of the per-pixel error estimates
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "AdaptiveSampler.hpp"
+
+using namespace std;
+
+void AdaptiveSampler::reset(int width, int height, int tileSz, float maxError)
+{
+	imgWidth = width;
+	imgHeight = height;
+	tileSize = max(1, tileSz);
+	threshold = maxError;
+
+	tiles.clear();
+	for (int y = 0; y < imgHeight; y += tileSize)
+		for (int x = 0; x < imgWidth; x += tileSize)
+			tiles.push_back({x, y, min(x + tileSize, imgWidth), min(y + tileSize, imgHeight)});
+	active.assign(tiles.size(), 1);
+}
+
+float AdaptiveSampler::relError(const AccumFilm& film, int pix) const
+{
+	double n = film.weight[pix];
+	if (n < 2)
+		return INFINITY;
+	return float(sqrt(film.variance(pix)/n)/(fabs(luminance(film.mean(pix))) + ADAPTIVE_FLOOR));
+}
+
+int AdaptiveSampler::update(const AccumFilm& film)
+{
+	int numActive = 0;
+	for (size_t t = 0; t < tiles.size(); t++)
+	{
+		if (!active[t])
+			continue;
+		/* A few pixels with rare bright paths would keep every tile busy, so the tile's mean error decides */
+		const Tile& tile = tiles[t];
+		double sum = 0;
+		for (int y = tile.y0; y < tile.y1; y++)
+			for (int x = tile.x0; x < tile.x1; x++)
+				sum += relError(film, y*imgWidth + x);
+		int n = (tile.x1 - tile.x0)*(tile.y1 - tile.y0);
+		bool converged = film.weight[tile.y0*imgWidth + tile.x0] >= ADAPTIVE_MIN_FRAMES && sum/n <= threshold;
+		active[t] = !converged;
+		numActive += active[t];
+	}
+	return numActive;
+}
+
+vector<Tile> AdaptiveSampler::activeTiles() const
+{
+	vector<Tile> rslt;
+	for (size_t t = 0; t < tiles.size(); t++)
+		if (active[t])
+			rslt.push_back(tiles[t]);
+	return rslt;
+}
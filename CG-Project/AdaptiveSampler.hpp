@@ -0,0 +1,71 @@
+#pragma once
+
+/**
+ * @file AdaptiveSampler.hpp
+ * @author
+ * @brief Contains the per-pixel error estimates which decide the tiles still worth rendering
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <vector>
+
+#include "AccumFilm.hpp"
+#include "ThreadPool.hpp"
+
+/* Frames every pixel gets before its variance estimate is trusted */
+#define ADAPTIVE_MIN_FRAMES 8
+
+/* Luminance added to the mean before dividing by it, so black pixels converge on absolute error */
+#define ADAPTIVE_FLOOR 0.01f
+
+/**
+ * @brief Struct deciding from the mean and variance which an AccumFilm keeps for every
+ * pixel which tiles still need frames. A tile stays active while the relative standard
+ * error of its pixels averages above the threshold, and only active tiles are handed
+ * to the pool.
+ *
+ */
+struct AdaptiveSampler
+{
+	int imgWidth = 0;
+	int imgHeight = 0;
+	int tileSize = TILE_SIZE;
+	float threshold = 0.0f;
+
+	std::vector<Tile> tiles;
+	std::vector<char> active;
+
+	/**
+	 * @brief Activates every tile
+	 *
+	 * @param width Width of the image
+	 * @param height Height of the image
+	 * @param tileSz Side of a square tile in pixels
+	 * @param maxError Relative standard error below which a pixel counts as converged
+	 */
+	void reset(int width, int height, int tileSz, float maxError);
+
+	/**
+	 * @brief Returns the standard error of the pixel's mean luminance relative to the mean
+	 *
+	 */
+	float relError(const AccumFilm& film, int pix) const;
+
+	/**
+	 * @brief Deactivates the tiles whose pixels have converged on average
+	 *
+	 * @param film Film the frames are accumulated in
+	 * @return int Number of tiles still active
+	 */
+	int update(const AccumFilm& film);
+
+	/**
+	 * @brief Returns the tiles which still need samples
+	 *
+	 */
+	std::vector<Tile> activeTiles() const;
+};
@@ -0,0 +1,657 @@
+/**
+ * @file BatchMath.cpp
+ * @author
+ * @brief Contains the scalar, SSE2, AVX2 and AVX-512 batch kernels and picks one of them at runtime
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BATCH_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#include "BatchMath.hpp"
+
+using namespace std;
+
+/*
+ * SSE2 is part of x86-64, the wider kernels are compiled for their instruction set one
+ * function at a time so that one binary runs on every CPU. MSVC compiles the intrinsics
+ * of any instruction set without flags.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+/* Every level must round exactly like the scalar kernels, so no fused multiply-adds */
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+int DetectSimdLevel()
+{
+#if !BATCH_X86
+	return SIMD_SCALAR;
+#elif defined(__GNUC__) || defined(__clang__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return SIMD_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+	return SIMD_SSE2;
+#else
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	/* The OS must save the YMM (and ZMM) registers on context switches */
+	bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+	if (maxLeaf < 7 || !osAvx)
+		return SIMD_SSE2;
+	unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	if ((info[1] & (1 << 16)) && (xcr0 & 0xE6) == 0xE6)
+		return SIMD_AVX512;
+	if ((info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6)
+		return SIMD_AVX2;
+	return SIMD_SSE2;
+#endif
+}
+
+static atomic<int> simdLimit(SIMD_AVX512);
+
+int BatchSimdLevel()
+{
+	static const int detected = DetectSimdLevel();
+	return min(detected, simdLimit.load(memory_order_relaxed));
+}
+
+void SetBatchSimdLevel(int level)
+{
+	simdLimit = level;
+}
+
+static const char* simdNames[] = {"scalar", "sse2", "avx2", "avx512"};
+
+int parseSimdLevel(const char* name)
+{
+	for (int level = SIMD_SCALAR; level <= SIMD_AVX512; level++)
+		if (!strcmp(name, simdNames[level]))
+			return level;
+	return -1;
+}
+
+const char* simdLevelName(int level)
+{
+	return simdNames[level];
+}
+
+/*
+ * Scalar kernels, for CPUs without SSE2 and for the elements [i, n) the vector kernels
+ * leave over. Every SIMD kernel below repeats their operations in the same order.
+ */
+
+static void dotScalar(const Vec3Stream& a, const Vec3Stream& b, float* out, int i, int n)
+{
+	for (; i < n; i++)
+		out[i] = a.x[i]*b.x[i] + a.y[i]*b.y[i] + a.z[i]*b.z[i];
+}
+
+static void crossScalar(const Vec3Stream& a, const Vec3Stream& b, const Vec3Stream& out, int i, int n)
+{
+	for (; i < n; i++)
+	{
+		float ax = a.x[i], ay = a.y[i], az = a.z[i], bx = b.x[i], by = b.y[i], bz = b.z[i];
+		out.x[i] = ay*bz - by*az;
+		out.y[i] = az*bx - bz*ax;
+		out.z[i] = ax*by - bx*ay;
+	}
+}
+
+static void normalizeScalar(const Vec3Stream& v, const Vec3Stream& out, int i, int n)
+{
+	for (; i < n; i++)
+	{
+		float x = v.x[i], y = v.y[i], z = v.z[i];
+		float inv = 1.0f/sqrtf(x*x + y*y + z*z);
+		out.x[i] = x*inv;
+		out.y[i] = y*inv;
+		out.z[i] = z*inv;
+	}
+}
+
+static void reflectScalar(const Vec3Stream& incident, const Vec3Stream& norm, const Vec3Stream& out, int i, int n)
+{
+	for (; i < n; i++)
+	{
+		float nx = norm.x[i], ny = norm.y[i], nz = norm.z[i];
+		float ix = incident.x[i], iy = incident.y[i], iz = incident.z[i];
+		float d = nx*ix + ny*iy + nz*iz;
+		out.x[i] = ix - nx*d*2.0f;
+		out.y[i] = iy - ny*d*2.0f;
+		out.z[i] = iz - nz*d*2.0f;
+	}
+}
+
+static void transformScalar(const mat3& m, const Vec3Stream& v, const Vec3Stream& out, int i, int n)
+{
+	for (; i < n; i++)
+	{
+		float x = v.x[i], y = v.y[i], z = v.z[i];
+		out.x[i] = m[0][0]*x + m[1][0]*y + m[2][0]*z;
+		out.y[i] = m[0][1]*x + m[1][1]*y + m[2][1]*z;
+		out.z[i] = m[0][2]*x + m[1][2]*y + m[2][2]*z;
+	}
+}
+
+static void tgnToWorldScalar(const Vec3Stream& norm, const Vec3Stream& v, const Vec3Stream& out, int i, int n)
+{
+	for (; i < n; i++)
+	{
+		float ax = norm.x[i], ay = norm.y[i], az = norm.z[i];
+		float lx = v.x[i], ly = v.y[i], lz = v.z[i];
+		/* tgn = normalize(cross(norm, helper)), helper = (1, 0, 0) or (0, 0, 1) near the x axis */
+		bool nearX = fabsf(ax) > 0.99f;
+		float hx = nearX ? 0.0f : 1.0f, hz = nearX ? 1.0f : 0.0f;
+		float tx = ay*hz, ty = az*hx - ax*hz, tz = -(ay*hx);
+		float inv = 1.0f/sqrtf(tx*tx + ty*ty + tz*tz);
+		tx = tx*inv;
+		ty = ty*inv;
+		tz = tz*inv;
+		float bx = ay*tz - az*ty, by = az*tx - ax*tz, bz = ax*ty - ay*tx;
+		inv = 1.0f/sqrtf(bx*bx + by*by + bz*bz);
+		bx = bx*inv;
+		by = by*inv;
+		bz = bz*inv;
+		out.x[i] = tx*lx + bx*ly + ax*lz;
+		out.y[i] = ty*lx + by*ly + ay*lz;
+		out.z[i] = tz*lx + bz*ly + az*lz;
+	}
+}
+
+#if BATCH_X86
+
+/* SSE2 kernels, four elements at a time. They return how many elements they did. */
+
+static int dotSSE2(const Vec3Stream& a, const Vec3Stream& b, float* out, int n)
+{
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 d = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a.x + i), _mm_loadu_ps(b.x + i)), _mm_mul_ps(_mm_loadu_ps(a.y + i), _mm_loadu_ps(b.y + i)));
+		_mm_storeu_ps(out + i, _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(a.z + i), _mm_loadu_ps(b.z + i))));
+	}
+	return i;
+}
+
+static int crossSSE2(const Vec3Stream& a, const Vec3Stream& b, const Vec3Stream& out, int n)
+{
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 ax = _mm_loadu_ps(a.x + i), ay = _mm_loadu_ps(a.y + i), az = _mm_loadu_ps(a.z + i);
+		__m128 bx = _mm_loadu_ps(b.x + i), by = _mm_loadu_ps(b.y + i), bz = _mm_loadu_ps(b.z + i);
+		_mm_storeu_ps(out.x + i, _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(by, az)));
+		_mm_storeu_ps(out.y + i, _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(bz, ax)));
+		_mm_storeu_ps(out.z + i, _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(bx, ay)));
+	}
+	return i;
+}
+
+static int normalizeSSE2(const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(v.x + i), y = _mm_loadu_ps(v.y + i), z = _mm_loadu_ps(v.z + i);
+		__m128 inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z))));
+		_mm_storeu_ps(out.x + i, _mm_mul_ps(x, inv));
+		_mm_storeu_ps(out.y + i, _mm_mul_ps(y, inv));
+		_mm_storeu_ps(out.z + i, _mm_mul_ps(z, inv));
+	}
+	return i;
+}
+
+static int reflectSSE2(const Vec3Stream& incident, const Vec3Stream& norm, const Vec3Stream& out, int n)
+{
+	const __m128 two = _mm_set1_ps(2.0f);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 nx = _mm_loadu_ps(norm.x + i), ny = _mm_loadu_ps(norm.y + i), nz = _mm_loadu_ps(norm.z + i);
+		__m128 ix = _mm_loadu_ps(incident.x + i), iy = _mm_loadu_ps(incident.y + i), iz = _mm_loadu_ps(incident.z + i);
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, ix), _mm_mul_ps(ny, iy)), _mm_mul_ps(nz, iz));
+		_mm_storeu_ps(out.x + i, _mm_sub_ps(ix, _mm_mul_ps(_mm_mul_ps(nx, d), two)));
+		_mm_storeu_ps(out.y + i, _mm_sub_ps(iy, _mm_mul_ps(_mm_mul_ps(ny, d), two)));
+		_mm_storeu_ps(out.z + i, _mm_sub_ps(iz, _mm_mul_ps(_mm_mul_ps(nz, d), two)));
+	}
+	return i;
+}
+
+static int transformSSE2(const mat3& m, const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	__m128 c[3][3];
+	for (int col = 0; col < 3; col++)
+		for (int row = 0; row < 3; row++)
+			c[col][row] = _mm_set1_ps(m[col][row]);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(v.x + i), y = _mm_loadu_ps(v.y + i), z = _mm_loadu_ps(v.z + i);
+		_mm_storeu_ps(out.x + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0][0], x), _mm_mul_ps(c[1][0], y)), _mm_mul_ps(c[2][0], z)));
+		_mm_storeu_ps(out.y + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0][1], x), _mm_mul_ps(c[1][1], y)), _mm_mul_ps(c[2][1], z)));
+		_mm_storeu_ps(out.z + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0][2], x), _mm_mul_ps(c[1][2], y)), _mm_mul_ps(c[2][2], z)));
+	}
+	return i;
+}
+
+static int tgnToWorldSSE2(const Vec3Stream& norm, const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	const __m128 one = _mm_set1_ps(1.0f), sign = _mm_set1_ps(-0.0f);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 ax = _mm_loadu_ps(norm.x + i), ay = _mm_loadu_ps(norm.y + i), az = _mm_loadu_ps(norm.z + i);
+		__m128 nearX = _mm_cmpgt_ps(_mm_andnot_ps(sign, ax), _mm_set1_ps(0.99f));
+		__m128 hx = _mm_andnot_ps(nearX, one), hz = _mm_and_ps(nearX, one);
+		__m128 tx = _mm_mul_ps(ay, hz);
+		__m128 ty = _mm_sub_ps(_mm_mul_ps(az, hx), _mm_mul_ps(ax, hz));
+		__m128 tz = _mm_xor_ps(_mm_mul_ps(ay, hx), sign);
+		__m128 inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz))));
+		tx = _mm_mul_ps(tx, inv);
+		ty = _mm_mul_ps(ty, inv);
+		tz = _mm_mul_ps(tz, inv);
+		__m128 bx = _mm_sub_ps(_mm_mul_ps(ay, tz), _mm_mul_ps(az, ty));
+		__m128 by = _mm_sub_ps(_mm_mul_ps(az, tx), _mm_mul_ps(ax, tz));
+		__m128 bz = _mm_sub_ps(_mm_mul_ps(ax, ty), _mm_mul_ps(ay, tx));
+		inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(bx, bx), _mm_mul_ps(by, by)), _mm_mul_ps(bz, bz))));
+		bx = _mm_mul_ps(bx, inv);
+		by = _mm_mul_ps(by, inv);
+		bz = _mm_mul_ps(bz, inv);
+		__m128 lx = _mm_loadu_ps(v.x + i), ly = _mm_loadu_ps(v.y + i), lz = _mm_loadu_ps(v.z + i);
+		_mm_storeu_ps(out.x + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, lx), _mm_mul_ps(bx, ly)), _mm_mul_ps(ax, lz)));
+		_mm_storeu_ps(out.y + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ty, lx), _mm_mul_ps(by, ly)), _mm_mul_ps(ay, lz)));
+		_mm_storeu_ps(out.z + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tz, lx), _mm_mul_ps(bz, ly)), _mm_mul_ps(az, lz)));
+	}
+	return i;
+}
+
+/* AVX2 kernels, eight elements at a time */
+
+TARGET_AVX2 static int dotAVX2(const Vec3Stream& a, const Vec3Stream& b, float* out, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 d = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(a.x + i), _mm256_loadu_ps(b.x + i)), _mm256_mul_ps(_mm256_loadu_ps(a.y + i), _mm256_loadu_ps(b.y + i)));
+		_mm256_storeu_ps(out + i, _mm256_add_ps(d, _mm256_mul_ps(_mm256_loadu_ps(a.z + i), _mm256_loadu_ps(b.z + i))));
+	}
+	return i;
+}
+
+TARGET_AVX2 static int crossAVX2(const Vec3Stream& a, const Vec3Stream& b, const Vec3Stream& out, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 ax = _mm256_loadu_ps(a.x + i), ay = _mm256_loadu_ps(a.y + i), az = _mm256_loadu_ps(a.z + i);
+		__m256 bx = _mm256_loadu_ps(b.x + i), by = _mm256_loadu_ps(b.y + i), bz = _mm256_loadu_ps(b.z + i);
+		_mm256_storeu_ps(out.x + i, _mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(by, az)));
+		_mm256_storeu_ps(out.y + i, _mm256_sub_ps(_mm256_mul_ps(az, bx), _mm256_mul_ps(bz, ax)));
+		_mm256_storeu_ps(out.z + i, _mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(bx, ay)));
+	}
+	return i;
+}
+
+TARGET_AVX2 static int normalizeAVX2(const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(v.x + i), y = _mm256_loadu_ps(v.y + i), z = _mm256_loadu_ps(v.z + i);
+		__m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z))));
+		_mm256_storeu_ps(out.x + i, _mm256_mul_ps(x, inv));
+		_mm256_storeu_ps(out.y + i, _mm256_mul_ps(y, inv));
+		_mm256_storeu_ps(out.z + i, _mm256_mul_ps(z, inv));
+	}
+	return i;
+}
+
+TARGET_AVX2 static int reflectAVX2(const Vec3Stream& incident, const Vec3Stream& norm, const Vec3Stream& out, int n)
+{
+	const __m256 two = _mm256_set1_ps(2.0f);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 nx = _mm256_loadu_ps(norm.x + i), ny = _mm256_loadu_ps(norm.y + i), nz = _mm256_loadu_ps(norm.z + i);
+		__m256 ix = _mm256_loadu_ps(incident.x + i), iy = _mm256_loadu_ps(incident.y + i), iz = _mm256_loadu_ps(incident.z + i);
+		__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, ix), _mm256_mul_ps(ny, iy)), _mm256_mul_ps(nz, iz));
+		_mm256_storeu_ps(out.x + i, _mm256_sub_ps(ix, _mm256_mul_ps(_mm256_mul_ps(nx, d), two)));
+		_mm256_storeu_ps(out.y + i, _mm256_sub_ps(iy, _mm256_mul_ps(_mm256_mul_ps(ny, d), two)));
+		_mm256_storeu_ps(out.z + i, _mm256_sub_ps(iz, _mm256_mul_ps(_mm256_mul_ps(nz, d), two)));
+	}
+	return i;
+}
+
+TARGET_AVX2 static int transformAVX2(const mat3& m, const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	__m256 c[3][3];
+	for (int col = 0; col < 3; col++)
+		for (int row = 0; row < 3; row++)
+			c[col][row] = _mm256_set1_ps(m[col][row]);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(v.x + i), y = _mm256_loadu_ps(v.y + i), z = _mm256_loadu_ps(v.z + i);
+		_mm256_storeu_ps(out.x + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[0][0], x), _mm256_mul_ps(c[1][0], y)), _mm256_mul_ps(c[2][0], z)));
+		_mm256_storeu_ps(out.y + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[0][1], x), _mm256_mul_ps(c[1][1], y)), _mm256_mul_ps(c[2][1], z)));
+		_mm256_storeu_ps(out.z + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[0][2], x), _mm256_mul_ps(c[1][2], y)), _mm256_mul_ps(c[2][2], z)));
+	}
+	return i;
+}
+
+TARGET_AVX2 static int tgnToWorldAVX2(const Vec3Stream& norm, const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	const __m256 one = _mm256_set1_ps(1.0f), sign = _mm256_set1_ps(-0.0f);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 ax = _mm256_loadu_ps(norm.x + i), ay = _mm256_loadu_ps(norm.y + i), az = _mm256_loadu_ps(norm.z + i);
+		__m256 nearX = _mm256_cmp_ps(_mm256_andnot_ps(sign, ax), _mm256_set1_ps(0.99f), _CMP_GT_OQ);
+		__m256 hx = _mm256_andnot_ps(nearX, one), hz = _mm256_and_ps(nearX, one);
+		__m256 tx = _mm256_mul_ps(ay, hz);
+		__m256 ty = _mm256_sub_ps(_mm256_mul_ps(az, hx), _mm256_mul_ps(ax, hz));
+		__m256 tz = _mm256_xor_ps(_mm256_mul_ps(ay, hx), sign);
+		__m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, tx), _mm256_mul_ps(ty, ty)), _mm256_mul_ps(tz, tz))));
+		tx = _mm256_mul_ps(tx, inv);
+		ty = _mm256_mul_ps(ty, inv);
+		tz = _mm256_mul_ps(tz, inv);
+		__m256 bx = _mm256_sub_ps(_mm256_mul_ps(ay, tz), _mm256_mul_ps(az, ty));
+		__m256 by = _mm256_sub_ps(_mm256_mul_ps(az, tx), _mm256_mul_ps(ax, tz));
+		__m256 bz = _mm256_sub_ps(_mm256_mul_ps(ax, ty), _mm256_mul_ps(ay, tx));
+		inv = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(bx, bx), _mm256_mul_ps(by, by)), _mm256_mul_ps(bz, bz))));
+		bx = _mm256_mul_ps(bx, inv);
+		by = _mm256_mul_ps(by, inv);
+		bz = _mm256_mul_ps(bz, inv);
+		__m256 lx = _mm256_loadu_ps(v.x + i), ly = _mm256_loadu_ps(v.y + i), lz = _mm256_loadu_ps(v.z + i);
+		_mm256_storeu_ps(out.x + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, lx), _mm256_mul_ps(bx, ly)), _mm256_mul_ps(ax, lz)));
+		_mm256_storeu_ps(out.y + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ty, lx), _mm256_mul_ps(by, ly)), _mm256_mul_ps(ay, lz)));
+		_mm256_storeu_ps(out.z + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tz, lx), _mm256_mul_ps(bz, ly)), _mm256_mul_ps(az, lz)));
+	}
+	return i;
+}
+
+/*
+ * AVX-512 kernels, sixteen elements at a time. AVX-512F has no float and/xor, the masks
+ * select with blends and the sign flips through the integer xor.
+ */
+
+TARGET_AVX512 static int dotAVX512(const Vec3Stream& a, const Vec3Stream& b, float* out, int n)
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512 d = _mm512_add_ps(_mm512_mul_ps(_mm512_loadu_ps(a.x + i), _mm512_loadu_ps(b.x + i)), _mm512_mul_ps(_mm512_loadu_ps(a.y + i), _mm512_loadu_ps(b.y + i)));
+		_mm512_storeu_ps(out + i, _mm512_add_ps(d, _mm512_mul_ps(_mm512_loadu_ps(a.z + i), _mm512_loadu_ps(b.z + i))));
+	}
+	return i;
+}
+
+TARGET_AVX512 static int crossAVX512(const Vec3Stream& a, const Vec3Stream& b, const Vec3Stream& out, int n)
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512 ax = _mm512_loadu_ps(a.x + i), ay = _mm512_loadu_ps(a.y + i), az = _mm512_loadu_ps(a.z + i);
+		__m512 bx = _mm512_loadu_ps(b.x + i), by = _mm512_loadu_ps(b.y + i), bz = _mm512_loadu_ps(b.z + i);
+		_mm512_storeu_ps(out.x + i, _mm512_sub_ps(_mm512_mul_ps(ay, bz), _mm512_mul_ps(by, az)));
+		_mm512_storeu_ps(out.y + i, _mm512_sub_ps(_mm512_mul_ps(az, bx), _mm512_mul_ps(bz, ax)));
+		_mm512_storeu_ps(out.z + i, _mm512_sub_ps(_mm512_mul_ps(ax, by), _mm512_mul_ps(bx, ay)));
+	}
+	return i;
+}
+
+/* _mm512_sqrt_ps() merges into an undefined register, which GCC reports as maybe uninitialized under -Wall */
+TARGET_AVX512 static inline __m512 sqrtAVX512(__m512 x)
+{
+	return _mm512_maskz_sqrt_ps(0xFFFF, x);
+}
+
+TARGET_AVX512 static int normalizeAVX512(const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	const __m512 one = _mm512_set1_ps(1.0f);
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512 x = _mm512_loadu_ps(v.x + i), y = _mm512_loadu_ps(v.y + i), z = _mm512_loadu_ps(v.z + i);
+		__m512 inv = _mm512_div_ps(one, sqrtAVX512(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(x, x), _mm512_mul_ps(y, y)), _mm512_mul_ps(z, z))));
+		_mm512_storeu_ps(out.x + i, _mm512_mul_ps(x, inv));
+		_mm512_storeu_ps(out.y + i, _mm512_mul_ps(y, inv));
+		_mm512_storeu_ps(out.z + i, _mm512_mul_ps(z, inv));
+	}
+	return i;
+}
+
+TARGET_AVX512 static int reflectAVX512(const Vec3Stream& incident, const Vec3Stream& norm, const Vec3Stream& out, int n)
+{
+	const __m512 two = _mm512_set1_ps(2.0f);
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512 nx = _mm512_loadu_ps(norm.x + i), ny = _mm512_loadu_ps(norm.y + i), nz = _mm512_loadu_ps(norm.z + i);
+		__m512 ix = _mm512_loadu_ps(incident.x + i), iy = _mm512_loadu_ps(incident.y + i), iz = _mm512_loadu_ps(incident.z + i);
+		__m512 d = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(nx, ix), _mm512_mul_ps(ny, iy)), _mm512_mul_ps(nz, iz));
+		_mm512_storeu_ps(out.x + i, _mm512_sub_ps(ix, _mm512_mul_ps(_mm512_mul_ps(nx, d), two)));
+		_mm512_storeu_ps(out.y + i, _mm512_sub_ps(iy, _mm512_mul_ps(_mm512_mul_ps(ny, d), two)));
+		_mm512_storeu_ps(out.z + i, _mm512_sub_ps(iz, _mm512_mul_ps(_mm512_mul_ps(nz, d), two)));
+	}
+	return i;
+}
+
+TARGET_AVX512 static int transformAVX512(const mat3& m, const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	__m512 c[3][3];
+	for (int col = 0; col < 3; col++)
+		for (int row = 0; row < 3; row++)
+			c[col][row] = _mm512_set1_ps(m[col][row]);
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512 x = _mm512_loadu_ps(v.x + i), y = _mm512_loadu_ps(v.y + i), z = _mm512_loadu_ps(v.z + i);
+		_mm512_storeu_ps(out.x + i, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(c[0][0], x), _mm512_mul_ps(c[1][0], y)), _mm512_mul_ps(c[2][0], z)));
+		_mm512_storeu_ps(out.y + i, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(c[0][1], x), _mm512_mul_ps(c[1][1], y)), _mm512_mul_ps(c[2][1], z)));
+		_mm512_storeu_ps(out.z + i, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(c[0][2], x), _mm512_mul_ps(c[1][2], y)), _mm512_mul_ps(c[2][2], z)));
+	}
+	return i;
+}
+
+TARGET_AVX512 static int tgnToWorldAVX512(const Vec3Stream& norm, const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f);
+	const __m512i sign = _mm512_set1_epi32(int(0x80000000));
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512 ax = _mm512_loadu_ps(norm.x + i), ay = _mm512_loadu_ps(norm.y + i), az = _mm512_loadu_ps(norm.z + i);
+		__mmask16 nearX = _mm512_cmp_ps_mask(_mm512_abs_ps(ax), _mm512_set1_ps(0.99f), _CMP_GT_OQ);
+		__m512 hx = _mm512_mask_blend_ps(nearX, one, zero), hz = _mm512_mask_blend_ps(nearX, zero, one);
+		__m512 tx = _mm512_mul_ps(ay, hz);
+		__m512 ty = _mm512_sub_ps(_mm512_mul_ps(az, hx), _mm512_mul_ps(ax, hz));
+		__m512 tz = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mul_ps(ay, hx)), sign));
+		__m512 inv = _mm512_div_ps(one, sqrtAVX512(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(tx, tx), _mm512_mul_ps(ty, ty)), _mm512_mul_ps(tz, tz))));
+		tx = _mm512_mul_ps(tx, inv);
+		ty = _mm512_mul_ps(ty, inv);
+		tz = _mm512_mul_ps(tz, inv);
+		__m512 bx = _mm512_sub_ps(_mm512_mul_ps(ay, tz), _mm512_mul_ps(az, ty));
+		__m512 by = _mm512_sub_ps(_mm512_mul_ps(az, tx), _mm512_mul_ps(ax, tz));
+		__m512 bz = _mm512_sub_ps(_mm512_mul_ps(ax, ty), _mm512_mul_ps(ay, tx));
+		inv = _mm512_div_ps(one, sqrtAVX512(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(bx, bx), _mm512_mul_ps(by, by)), _mm512_mul_ps(bz, bz))));
+		bx = _mm512_mul_ps(bx, inv);
+		by = _mm512_mul_ps(by, inv);
+		bz = _mm512_mul_ps(bz, inv);
+		__m512 lx = _mm512_loadu_ps(v.x + i), ly = _mm512_loadu_ps(v.y + i), lz = _mm512_loadu_ps(v.z + i);
+		_mm512_storeu_ps(out.x + i, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(tx, lx), _mm512_mul_ps(bx, ly)), _mm512_mul_ps(ax, lz)));
+		_mm512_storeu_ps(out.y + i, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ty, lx), _mm512_mul_ps(by, ly)), _mm512_mul_ps(ay, lz)));
+		_mm512_storeu_ps(out.z + i, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(tz, lx), _mm512_mul_ps(bz, ly)), _mm512_mul_ps(az, lz)));
+	}
+	return i;
+}
+
+#endif
+
+/*
+ * Dispatch: the widest kernel the level allows does as many elements as fit its
+ * registers, the scalar kernel the rest.
+ */
+
+void BatchDot(const Vec3Stream& a, const Vec3Stream& b, float* out, int n)
+{
+	int i = 0;
+	switch (BatchSimdLevel())
+	{
+#if BATCH_X86
+	case SIMD_AVX512:
+		i = dotAVX512(a, b, out, n);
+		break;
+	case SIMD_AVX2:
+		i = dotAVX2(a, b, out, n);
+		break;
+	case SIMD_SSE2:
+		i = dotSSE2(a, b, out, n);
+		break;
+#endif
+	default:
+		break;
+	}
+	dotScalar(a, b, out, i, n);
+}
+
+void BatchCross(const Vec3Stream& a, const Vec3Stream& b, const Vec3Stream& out, int n)
+{
+	int i = 0;
+	switch (BatchSimdLevel())
+	{
+#if BATCH_X86
+	case SIMD_AVX512:
+		i = crossAVX512(a, b, out, n);
+		break;
+	case SIMD_AVX2:
+		i = crossAVX2(a, b, out, n);
+		break;
+	case SIMD_SSE2:
+		i = crossSSE2(a, b, out, n);
+		break;
+#endif
+	default:
+		break;
+	}
+	crossScalar(a, b, out, i, n);
+}
+
+void BatchNormalize(const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	int i = 0;
+	switch (BatchSimdLevel())
+	{
+#if BATCH_X86
+	case SIMD_AVX512:
+		i = normalizeAVX512(v, out, n);
+		break;
+	case SIMD_AVX2:
+		i = normalizeAVX2(v, out, n);
+		break;
+	case SIMD_SSE2:
+		i = normalizeSSE2(v, out, n);
+		break;
+#endif
+	default:
+		break;
+	}
+	normalizeScalar(v, out, i, n);
+}
+
+void BatchReflect(const Vec3Stream& incident, const Vec3Stream& norm, const Vec3Stream& out, int n)
+{
+	int i = 0;
+	switch (BatchSimdLevel())
+	{
+#if BATCH_X86
+	case SIMD_AVX512:
+		i = reflectAVX512(incident, norm, out, n);
+		break;
+	case SIMD_AVX2:
+		i = reflectAVX2(incident, norm, out, n);
+		break;
+	case SIMD_SSE2:
+		i = reflectSSE2(incident, norm, out, n);
+		break;
+#endif
+	default:
+		break;
+	}
+	reflectScalar(incident, norm, out, i, n);
+}
+
+void BatchTransform(const mat3& m, const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	int i = 0;
+	switch (BatchSimdLevel())
+	{
+#if BATCH_X86
+	case SIMD_AVX512:
+		i = transformAVX512(m, v, out, n);
+		break;
+	case SIMD_AVX2:
+		i = transformAVX2(m, v, out, n);
+		break;
+	case SIMD_SSE2:
+		i = transformSSE2(m, v, out, n);
+		break;
+#endif
+	default:
+		break;
+	}
+	transformScalar(m, v, out, i, n);
+}
+
+void BatchTgnToWorld(const Vec3Stream& norm, const Vec3Stream& v, const Vec3Stream& out, int n)
+{
+	int i = 0;
+	switch (BatchSimdLevel())
+	{
+#if BATCH_X86
+	case SIMD_AVX512:
+		i = tgnToWorldAVX512(norm, v, out, n);
+		break;
+	case SIMD_AVX2:
+		i = tgnToWorldAVX2(norm, v, out, n);
+		break;
+	case SIMD_SSE2:
+		i = tgnToWorldSSE2(norm, v, out, n);
+		break;
+#endif
+	default:
+		break;
+	}
+	tgnToWorldScalar(norm, v, out, i, n);
+}
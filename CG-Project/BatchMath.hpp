@@ -0,0 +1,115 @@
+#pragma once
+
+/**
+ * @file BatchMath.hpp
+ * @author
+ * @brief Contains dot, cross, normalize, reflect and mat3 kernels over arrays of vec3s stored one array per component
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "MltPixel.hpp"
+
+/* Instruction sets the batch kernels can run on, from narrowest to widest */
+#define SIMD_SCALAR 0
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2
+#define SIMD_AVX512 3
+
+/**
+ * @brief Struct for n vec3s stored as three arrays of floats, like the queues of the
+ * wavefront. Does not own the arrays.
+ *
+ */
+struct Vec3Stream
+{
+	float* x;
+	float* y;
+	float* z;
+
+	/**
+	 * @brief Returns the stream starting at element i
+	 *
+	 */
+	Vec3Stream from(int i) const
+	{
+		return {x + i, y + i, z + i};
+	}
+};
+
+/**
+ * @brief Returns the widest instruction set the CPU and the OS support, out of the ones
+ * this build has kernels for
+ *
+ */
+int DetectSimdLevel();
+
+/**
+ * @brief Returns the instruction set the batch kernels run on. Defaults to DetectSimdLevel().
+ *
+ */
+int BatchSimdLevel();
+
+/**
+ * @brief Limits the batch kernels to the given instruction set, or to DetectSimdLevel()
+ * if the CPU lacks it. Every level rounds exactly the same, so this only changes the
+ * speed.
+ *
+ * @param level One of the SIMD_ levels
+ */
+void SetBatchSimdLevel(int level);
+
+/**
+ * @brief Returns the SIMD_ level named scalar, sse2, avx2 or avx512, -1 for other names
+ *
+ */
+int parseSimdLevel(const char* name);
+
+const char* simdLevelName(int level);
+
+/*
+ * The kernels below run over n elements. out may be one of the inputs, every element is
+ * read before it is written. They round like the glm functions they are named after,
+ * without fused multiply-adds, on every SIMD_ level.
+ */
+
+/**
+ * @brief out[i] = dot(a[i], b[i])
+ *
+ */
+void BatchDot(const Vec3Stream& a, const Vec3Stream& b, float* out, int n);
+
+/**
+ * @brief out[i] = cross(a[i], b[i])
+ *
+ */
+void BatchCross(const Vec3Stream& a, const Vec3Stream& b, const Vec3Stream& out, int n);
+
+/**
+ * @brief out[i] = normalize(v[i])
+ *
+ */
+void BatchNormalize(const Vec3Stream& v, const Vec3Stream& out, int n);
+
+/**
+ * @brief out[i] = reflect(incident[i], norm[i]), norm[i] of unit length
+ *
+ */
+void BatchReflect(const Vec3Stream& incident, const Vec3Stream& norm, const Vec3Stream& out, int n);
+
+/**
+ * @brief out[i] = m*v[i]
+ *
+ */
+void BatchTransform(const mat3& m, const Vec3Stream& v, const Vec3Stream& out, int n);
+
+/**
+ * @brief out[i] = GetTgnSpace(norm[i])*v[i], turns directions sampled around the z axis
+ * into directions around the normals. The tangent is the cross product with the helper
+ * axis written out, so zero components may differ from GetTgnSpace() in their sign.
+ *
+ */
+void BatchTgnToWorld(const Vec3Stream& norm, const Vec3Stream& v, const Vec3Stream& out, int n);
@@ -0,0 +1,364 @@
+/**
+ * @file Bdpt.cpp
+ * @author
+ * @brief Contains the implementation of the bidirectional path tracer
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "Bdpt.hpp"
+#include "Scene.hpp"
+
+using namespace std;
+
+/* Pinhole camera of primaryRay(): the eye looks down -z through the window |x|, |y| <= 5 of
+ * the plane z = 0. Its importance is normalized over the window seen at unit distance. */
+static const vec3 camOrg = vec3(1.0f, 2.0f, 10.0f);
+static const float camWindow = 5.0f;
+static const float camArea = (2*camWindow/camOrg.z)*(2*camWindow/camOrg.z);
+
+/**
+ * @brief Returns the solid angle density of the camera sampling the unit direction dir
+ * uniformly over the window, or 0 if dir misses the window
+ *
+ */
+static float cameraPdf(vec3 dir, int imgWidth, int imgHeight, int* pix)
+{
+	float cosTheta = -dir.z;
+	if (cosTheta <= 0)
+		return 0;
+	vec3 p = camOrg + (camOrg.z/cosTheta)*dir;
+	float fx = (p.x/camWindow + 1)*0.5f*imgWidth, fy = (p.y/camWindow + 1)*0.5f*imgHeight;
+	if (fx < 0 || fy < 0 || fx >= imgWidth || fy >= imgHeight)
+		return 0;
+	if (pix)
+		*pix = int(fy)*imgWidth + int(fx);
+	return 1.0f/(camArea*cosTheta*cosTheta*cosTheta);
+}
+
+/**
+ * @brief Returns true if nothing blocks the segment between the points a and b. Surface
+ * points are moved off their surface like in Shade(). Triangles block from both sides: a
+ * connection is traced in whichever direction suits it, and light subpaths start on
+ * emitters behind the backs of the walls.
+ *
+ */
+static bool visible(vec3 a, vec3 b)
+{
+	Ray ray;
+	ray.org = a;
+	vec3 d = b - a;
+	float dist = length(d);
+	ray.dir = d/dist;
+	ray.nrg = vec3(1.0f);
+	return !Occluded(ray, dist*(1 - 1e-3f) - 1e-3f, true);
+}
+
+/**
+ * @brief Converts a solid angle density at from into an area density at to
+ *
+ */
+static float toArea(float pdfDir, const BdptVertex& from, const BdptVertex& to)
+{
+	vec3 d = to.hit.pos - from.hit.pos;
+	float dist2 = dot(d, d);
+	if (to.type == BDPT_CAMERA || dist2 == 0)
+		return pdfDir;
+	return pdfDir*abs(dot(to.hit.norm, d))/(dist2*sqrt(dist2));
+}
+
+/**
+ * @brief Returns the origin of a ray leaving the vertex, offset like in Shade()
+ *
+ */
+static vec3 rayOrigin(const BdptVertex& v)
+{
+	return v.type == BDPT_CAMERA ? v.hit.pos : v.hit.pos + v.hit.norm*0.001f;
+}
+
+/**
+ * @brief Extends a subpath by sampling the BSDF at every hit until it leaves the scene
+ * or has maxVerts vertices. Triangles are hit from both sides like in visible(), with the
+ * normal turned towards the ray, so that light subpaths cannot walk through the walls.
+ *
+ * @param ray First ray leaving path[0]
+ * @param beta Throughput carried by the first ray
+ * @param pdfDir Solid angle density of the first ray
+ * @param path Subpath whose first vertex is set
+ * @param maxVerts Maximum number of vertices
+ * @param rng Random Number Generator
+ * @return int Number of vertices
+ */
+static int randomWalk(Ray ray, vec3 beta, float pdfDir, BdptVertex* path, int maxVerts, Rng& rng)
+{
+	int n = 1;
+	while (n < maxVerts)
+	{
+		RayHit hit = Trace(ray, true);
+		if (hit.skybox || hit.dist <= 0.01)
+			break;
+		if (dot(hit.norm, ray.dir) > 0)
+			hit.norm = -hit.norm;
+		BdptVertex& v = path[n];
+		BdptVertex& prev = path[n - 1];
+		v.type = BDPT_SURFACE;
+		v.hit = hit;
+		v.beta = beta;
+		v.wi = -ray.dir;
+		v.pdfFwd = toArea(pdfDir, prev, v);
+		v.pdfRev = 0;
+		if (++n == maxVerts)
+			break;
+
+		vec3 wo = SampleBsdf(hit, v.wi, rng);
+		float pdfFwd = PdfBsdf(hit, v.wi, wo);
+		vec3 f = EvalBsdf(hit, v.wi, wo);
+		if (pdfFwd <= 0 || (f.x == 0 && f.y == 0 && f.z == 0))
+			break;
+		beta *= f*(dot(hit.norm, wo)/pdfFwd);
+		prev.pdfRev = toArea(PdfBsdf(hit, wo, v.wi), v, prev);
+		ray.org = rayOrigin(v);
+		ray.dir = wo;
+		pdfDir = pdfFwd;
+	}
+	return n;
+}
+
+void Bdpt::init(const Scene& scn, int width, int height)
+{
+	scene = &scn;
+	imgWidth = width;
+	imgHeight = height;
+	frames = 0;
+	film.reset(width, height);
+}
+
+int Bdpt::cameraSubpath(int x, int y, BdptVertex* path, Rng& rng) const
+{
+	/* Jittered version of primaryRay(), uniform over the footprint of the pixel */
+	float fx = x + rng.next(), fy = y + rng.next();
+	vec3 p = vec3((2*fx/imgWidth - 1)*camWindow, (2*fy/imgHeight - 1)*camWindow, 0.0f);
+	Ray ray;
+	ray.org = camOrg;
+	ray.dir = normalize(p - camOrg);
+	ray.nrg = vec3(1.0f);
+
+	BdptVertex& cam = path[0];
+	cam.type = BDPT_CAMERA;
+	cam.hit = CreateRayHit();
+	cam.hit.pos = camOrg;
+	cam.hit.norm = vec3(0.0f, 0.0f, -1.0f);
+	cam.beta = vec3(1.0f);
+	cam.pdfFwd = 1;
+	cam.pdfRev = 0;
+	return randomWalk(ray, vec3(1.0f), cameraPdf(ray.dir, imgWidth, imgHeight, nullptr), path, getConfig().maxHits + 2, rng);
+}
+
+int Bdpt::lightSubpath(BdptVertex* path, Rng& rng) const
+{
+	float pickPdf;
+	int sph = scene->sampleEmitter(rng.next(), pickPdf);
+	if (sph < 0)
+		return 0;
+
+	/* Uniform point on the sphere, cosine weighted direction around its normal */
+	float rad = scene->sphRad[sph];
+	float z = 1 - 2*rng.next(), phi = 2*3.141593f*rng.next();
+	float r = sqrt(max(0.0f, 1 - z*z));
+	vec3 norm = vec3(r*cos(phi), r*sin(phi), z);
+
+	BdptVertex& light = path[0];
+	light.type = BDPT_LIGHT;
+	light.hit = CreateRayHit();
+	light.hit.pos = scene->sphPos[sph] + rad*norm;
+	light.hit.norm = norm;
+	light.hit.mat = &scene->mats[scene->sphMat[sph]];
+	light.pdfFwd = pickPdf/(4*3.141593f*rad*rad);
+	light.pdfRev = 0;
+	light.beta = light.hit.mat->emission/light.pdfFwd;
+
+	Ray ray;
+	ray.org = rayOrigin(light);
+	ray.dir = SampleHemi(norm, 1.0f, rng);
+	ray.nrg = vec3(1.0f);
+	float pdfDir = dot(norm, ray.dir)/3.141593f;
+	if (pdfDir <= 0)
+		return 1;
+	/* Le*cos/(pdfPos*pdfDir) with the cosine density */
+	return randomWalk(ray, light.beta*3.141593f, pdfDir, path, getConfig().maxHits + 1, rng);
+}
+
+float Bdpt::pdfTo(const BdptVertex& v, const BdptVertex* prev, const BdptVertex& next) const
+{
+	vec3 dir = normalize(next.hit.pos - v.hit.pos);
+	float pdfDir;
+	if (v.type == BDPT_CAMERA)
+		pdfDir = cameraPdf(dir, imgWidth, imgHeight, nullptr);
+	else if (v.type == BDPT_LIGHT || !prev)
+		pdfDir = max(0.0f, dot(v.hit.norm, dir))/3.141593f;
+	else
+		pdfDir = PdfBsdf(v.hit, normalize(prev->hit.pos - v.hit.pos), dir);
+	return toArea(pdfDir, v, next);
+}
+
+float Bdpt::pdfLightOrigin(const BdptVertex& v) const
+{
+	int sph = scene->findEmitter(v.hit.pos);
+	if (sph < 0)
+		return 0;
+	float rad = scene->sphRad[sph];
+	return scene->emitterPdf(sph)/(4*3.141593f*rad*rad);
+}
+
+vec3 Bdpt::connect(const BdptVertex* cam, const BdptVertex* light, int s, int t, int& pix) const
+{
+	const BdptVertex& pt = cam[t - 1];
+	if (s == 0)
+	{
+		/* The camera subpath hit an emitter from its front */
+		if (pt.type != BDPT_SURFACE || dot(pt.hit.norm, pt.wi) <= 0)
+			return vec3(0.0f);
+		return pt.beta*pt.hit.mat->emission;
+	}
+
+	const BdptVertex& qs = light[s - 1];
+	vec3 d = qs.hit.pos - pt.hit.pos;
+	float dist2 = dot(d, d);
+	vec3 dir = d/sqrt(dist2);
+	vec3 fc, fl;
+	float cosC, cosL = abs(dot(qs.hit.norm, dir));
+	if (t == 1)
+	{
+		/* Light tracing, the importance of the pinhole replaces the camera BSDF */
+		float pdfCam = cameraPdf(dir, imgWidth, imgHeight, &pix);
+		if (pdfCam == 0)
+			return vec3(0.0f);
+		cosC = -dir.z;
+		fc = vec3(pdfCam/cosC);
+	}
+	else
+	{
+		cosC = abs(dot(pt.hit.norm, dir));
+		fc = EvalBsdf(pt.hit, pt.wi, dir);
+	}
+	if (s == 1)
+		fl = vec3(dot(qs.hit.norm, dir) < 0 ? 1.0f : 0.0f);
+	else
+		fl = EvalBsdf(qs.hit, qs.wi, -dir);
+
+	vec3 c = pt.beta*fc*fl*qs.beta*(cosC*cosL/dist2);
+	if ((c.x == 0 && c.y == 0 && c.z == 0) || !visible(rayOrigin(pt), rayOrigin(qs)))
+		return vec3(0.0f);
+	return c;
+}
+
+float Bdpt::misWeight(BdptVertex* cam, BdptVertex* light, int s, int t) const
+{
+	BdptVertex& pt = cam[t - 1];
+	BdptVertex* ptMinus = t > 1 ? &cam[t - 2] : nullptr;
+	BdptVertex* qs = s > 0 ? &light[s - 1] : nullptr;
+	BdptVertex* qsMinus = s > 1 ? &light[s - 2] : nullptr;
+
+	/* Reverse densities of the four vertices next to the connection, restored below */
+	float oldPt = pt.pdfRev, oldPtMinus = ptMinus ? ptMinus->pdfRev : 0;
+	float oldQs = qs ? qs->pdfRev : 0, oldQsMinus = qsMinus ? qsMinus->pdfRev : 0;
+	if (s > 0)
+	{
+		pt.pdfRev = pdfTo(*qs, qsMinus, pt);
+		qs->pdfRev = pdfTo(pt, ptMinus, *qs);
+		if (ptMinus)
+			ptMinus->pdfRev = pdfTo(pt, qs, *ptMinus);
+		if (qsMinus)
+			qsMinus->pdfRev = pdfTo(*qs, &pt, *qsMinus);
+	}
+	else
+	{
+		/* pt is an emitter, as a light subpath it would start there */
+		pt.pdfRev = pdfLightOrigin(pt);
+		BdptVertex asLight = pt;
+		asLight.type = BDPT_LIGHT;
+		ptMinus->pdfRev = pdfTo(asLight, nullptr, *ptMinus);
+	}
+
+	/* Ratios of the densities of the other strategies to this one, squared for the power heuristic */
+	float sumRi = 0, ri = 1;
+	for (int i = t - 1; i > 0; i--)
+	{
+		ri *= cam[i].pdfFwd > 0 ? cam[i].pdfRev/cam[i].pdfFwd : 0;
+		sumRi += ri*ri;
+	}
+	ri = 1;
+	for (int i = s - 1; i >= 0; i--)
+	{
+		ri *= light[i].pdfFwd > 0 ? light[i].pdfRev/light[i].pdfFwd : 0;
+		sumRi += ri*ri;
+	}
+
+	pt.pdfRev = oldPt;
+	if (ptMinus)
+		ptMinus->pdfRev = oldPtMinus;
+	if (qs)
+		qs->pdfRev = oldQs;
+	if (qsMinus)
+		qsMinus->pdfRev = oldQsMinus;
+	return 1/(1 + sumRi);
+}
+
+void Bdpt::renderPixel(int x, int y, unsigned frame)
+{
+	BdptVertex cam[BDPT_CAMERA_VERTS], light[BDPT_LIGHT_VERTS];
+	Rng rng(y*imgWidth + x, frame);
+	int nCam = cameraSubpath(x, y, cam, rng);
+	int nLight = lightSubpath(light, rng);
+
+	vec3 rslt = vec3(0.0f);
+	/* Like TracePath(), which samples an emitter at its last hit: maxHits bounces, then the light */
+	int maxVerts = getConfig().maxHits + 2;
+	for (int t = 1; t <= nCam; t++)
+		for (int s = 0; s <= nLight && s + t <= maxVerts; s++)
+		{
+			if (s + t < 2 || (t == 1 && s == 0))
+				continue;
+			int pix = -1;
+			vec3 c = connect(cam, light, s, t, pix);
+			if (c.x == 0 && c.y == 0 && c.z == 0)
+				continue;
+			c *= misWeight(cam, light, s, t);
+			if (!isfinite(c.x) || !isfinite(c.y) || !isfinite(c.z))
+				continue;
+			if (t == 1)
+				film.splat(pix, c);
+			else
+				rslt += c;
+		}
+	film.splat(y*imgWidth + x, rslt);
+}
+
+FrameHandle Bdpt::iterate(ThreadPool& pool, unsigned frame)
+{
+	frames++;
+	return pool.renderFrame(imgWidth, imgHeight, TILE_SIZE,
+		[this, frame](const Tile& tile, atomic<int>& done)
+		{
+			for (int y = tile.y0; y < tile.y1; y++)
+				for (int x = tile.x0; x < tile.x1; x++)
+				{
+					renderPixel(x, y, frame);
+					done++;
+				}
+		});
+}
+
+void Bdpt::resolve(vec3* img) const
+{
+	/* Every frame traces as many light subpaths as there are pixels, so the splats share the 1/frames scale */
+	float scale = frames > 0 ? 1.0f/frames : 0.0f;
+	for (int i = 0; i < imgWidth*imgHeight; i++)
+		img[i] = film.get(i)*scale;
+}
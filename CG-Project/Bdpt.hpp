@@ -0,0 +1,132 @@
+#pragma once
+
+/**
+ * @file Bdpt.hpp
+ * @author
+ * @brief Contains the bidirectional path tracer with multiple importance sampling (Veach 1997)
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "MltPixel.hpp"
+#include "SplatFilm.hpp"
+#include "ThreadPool.hpp"
+
+/* Vertex kinds of a subpath */
+#define BDPT_CAMERA 0
+#define BDPT_LIGHT 1
+#define BDPT_SURFACE 2
+
+/*
+ * Longest subpaths: a full path has at most RenderConfig::maxHits bounces before the emitter,
+ * maxHits + 2 vertices. Both subpaths are long enough for every strategy of such a path, the
+ * camera one to hit the emitter and the light one to reach the camera, as the MIS weights
+ * count all of them.
+ */
+#define BDPT_CAMERA_VERTS (MAX_HITS + 2)
+#define BDPT_LIGHT_VERTS (MAX_HITS + 1)
+
+struct Scene;
+
+/**
+ * @brief Struct for a vertex of a camera or light subpath
+ *
+ */
+struct BdptVertex
+{
+	int type;
+	/* Position, normal and material of the vertex */
+	RayHit hit;
+	/* Throughput of the subpath up to the vertex, including the emission for light subpaths */
+	vec3 beta;
+	/* Unit direction towards the previous vertex of the subpath */
+	vec3 wi;
+	/* Area density of sampling the vertex from the previous one, and from the next one in reverse */
+	float pdfFwd;
+	float pdfRev;
+};
+
+/**
+ * @brief Struct containing the bidirectional path tracer. Every pixel traces one camera and
+ * one light subpath per frame and combines all their connection strategies with power
+ * heuristic weights. Strategies connecting to the camera land in other pixels and are
+ * splatted, so the estimate only exists for the whole film.
+ *
+ */
+struct Bdpt
+{
+	const Scene* scene = nullptr;
+	int imgWidth = 0;
+	int imgHeight = 0;
+
+	/* Frames splatted into the film */
+	int frames = 0;
+
+	SplatFilm film;
+
+	/**
+	 * @brief Clears the film
+	 *
+	 * @param scn Scene rendered, also set with setScene()
+	 * @param width Width of the image
+	 * @param height Height of the image
+	 */
+	void init(const Scene& scn, int width, int height);
+
+	/**
+	 * @brief Starts rendering one frame
+	 *
+	 * @param pool Threads rendering the tiles
+	 * @param frame Index of the frame, keys the random numbers
+	 * @return FrameHandle Handle of the frame
+	 */
+	FrameHandle iterate(ThreadPool& pool, unsigned frame);
+
+	/**
+	 * @brief Writes the average of the rendered frames, bottom row first
+	 *
+	 * @param img Image of imgWidth*imgHeight pixels
+	 */
+	void resolve(vec3* img) const;
+
+	/**
+	 * @brief Traces both subpaths of a pixel, adds the strategies ending in the pixel and
+	 * splats those connecting to the camera
+	 *
+	 */
+	void renderPixel(int x, int y, unsigned frame);
+
+private:
+	int cameraSubpath(int x, int y, BdptVertex* path, Rng& rng) const;
+	int lightSubpath(BdptVertex* path, Rng& rng) const;
+
+	/**
+	 * @brief Returns the unweighted contribution of joining light[0..s) and cam[0..t).
+	 * For t == 1 the pixel the path lands in is returned in pix.
+	 *
+	 */
+	vec3 connect(const BdptVertex* cam, const BdptVertex* light, int s, int t, int& pix) const;
+
+	/**
+	 * @brief Returns the power heuristic weight of the strategy (s, t) among every
+	 * strategy which could have sampled the same path
+	 *
+	 */
+	float misWeight(BdptVertex* cam, BdptVertex* light, int s, int t) const;
+
+	/**
+	 * @brief Returns the area density at next of sampling it from v, which was reached from prev
+	 *
+	 */
+	float pdfTo(const BdptVertex& v, const BdptVertex* prev, const BdptVertex& next) const;
+
+	/**
+	 * @brief Returns the area density with which the light subpath starts at a camera vertex
+	 * lying on an emitter
+	 *
+	 */
+	float pdfLightOrigin(const BdptVertex& v) const;
+};
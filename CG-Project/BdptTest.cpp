@@ -0,0 +1,178 @@
+/**
+ * @file BdptTest.cpp
+ * @author
+ * @brief Checks that the bidirectional path tracer converges to the same image mean as the
+ * path tracer. Returns 1 if the means differ by more than the noise allows.
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "AccumFilm.hpp"
+#include "Bdpt.hpp"
+#include "MltPixel.hpp"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+
+using namespace std;
+
+/* Small image, many frames: the test compares image means, not pixels */
+#define TEST_SIZE 64
+/*
+ * primaryRay() shoots through the corner of every pixel while BDPT's camera jitters over the
+ * whole pixel, which moves the path tracer's image mean by about c/size. It renders at two
+ * multiples of BDPT's size, whose means are extrapolated to an infinite one. Its estimate
+ * varies far less than BDPT's, so it gets a fraction of the frames.
+ */
+#define TEST_PT_SCALE 4
+#define TEST_PT_FRAMES_DIV 16
+/* Standard errors the means may differ by */
+#define TEST_SIGMAS 4
+
+static const char* flagValue(int argc, char** argv, const char* flag, const char* def)
+{
+	for (int i = 1; i + 1 < argc; i++)
+		if (strcmp(argv[i], flag) == 0)
+			return argv[i + 1];
+	return def;
+}
+
+/**
+ * @brief Struct for the mean of an image over frames and its standard error
+ *
+ */
+struct FrameStats
+{
+	double mean = 0, error = 0;
+
+	FrameStats(double mean, double error) : mean(mean), error(error) {}
+
+	/* Frames are independent, so their image means scatter around the converged one */
+	FrameStats(const vector<double>& frameMeans)
+	{
+		int n = (int)frameMeans.size();
+		for (double m : frameMeans)
+			mean += m/n;
+		double var = 0;
+		for (double m : frameMeans)
+			var += (m - mean)*(m - mean)/(n - 1);
+		error = sqrt(var/n);
+	}
+};
+
+static double imageMean(const vector<vec3>& img)
+{
+	double sum = 0;
+	for (const vec3& c : img)
+		sum += double(c.x) + c.y + c.z;
+	return sum/(3*img.size());
+}
+
+/**
+ * @brief Renders frames of the path tracer, or of BDPT, and returns the image mean of each.
+ * Both films only hold the average over all frames so far, the mean of frame f is taken
+ * from the sums before and after it.
+ *
+ */
+static vector<double> renderFrames(ThreadPool& pool, const Scene& scene, bool bdpt, int size, int frames)
+{
+	vector<vec3> img(size*size);
+	vector<double> means;
+	AccumFilm film;
+	film.reset(size, size);
+	Bdpt bidir;
+	if (bdpt)
+		bidir.init(scene, size, size);
+	double sum = 0;
+	for (int f = 0; f < frames; f++)
+	{
+		if (bdpt)
+			bidir.iterate(pool, f).wait();
+		else
+			pool.renderFrame(size, size, TILE_SIZE,
+				[&](const Tile& tile, atomic<int>& done)
+				{
+					for (int y = tile.y0; y < tile.y1; y++)
+						drawPixels(tile.x0, tile.x1, y, size, size, film, done, f, true);
+				}).wait();
+		if (bdpt)
+			bidir.resolve(img.data());
+		else
+			film.resolve(img.data());
+		double total = imageMean(img)*(f + 1);
+		means.push_back(total - sum);
+		sum = total;
+	}
+	return means;
+}
+
+/**
+ * @brief Returns the path tracer's image mean, extrapolated from two sizes to pixels as
+ * small as BDPT's jitter makes them
+ *
+ */
+static FrameStats renderPathTracer(ThreadPool& pool, const Scene& scene, int frames)
+{
+	frames = max(2, frames/TEST_PT_FRAMES_DIV);
+	FrameStats coarse(renderFrames(pool, scene, false, TEST_PT_SCALE*TEST_SIZE, frames));
+	FrameStats fine(renderFrames(pool, scene, false, 2*TEST_PT_SCALE*TEST_SIZE, frames));
+	return FrameStats(2*fine.mean - coarse.mean, hypot(2*fine.error, coarse.error));
+}
+
+/*
+ * The path tracer ends its paths after maxHits bounces, but samples an emitter at the last
+ * of them, so it adds part of the paths with maxHits bounces before the emitter. BDPT adds
+ * all of them, the path tracer with maxHits + 1 bounces all of them and part of the next
+ * ones. BDPT's mean has to lie between the two.
+ */
+int main(int argc, char** argv)
+{
+	int maxHits = atoi(flagValue(argc, argv, "--max-hits", "2"));
+	int frames = atoi(flagValue(argc, argv, "--frames", "256"));
+	Scene scene;
+	if (!scene.load(flagValue(argc, argv, "--scene", "bdpt_test.txt")))
+		return 1;
+	if (scene.numEmitters() == 0 || frames < 2 || maxHits < 1 || maxHits >= MAX_HITS)
+	{
+		printf("BDPT needs an emissive sphere, the test at least two frames and max hits below %d\n", MAX_HITS);
+		return 1;
+	}
+	setScene(&scene);
+	ThreadPool pool;
+
+	RenderConfig cfg;
+	cfg.mutations = 0;
+	cfg.samples = 1;
+	/* No Russian roulette, every path runs to maxHits */
+	cfg.minHits = MAX_HITS;
+	vector<FrameStats> stats;
+	const char* names[3] = {"path tracer, max hits", "BDPT, max hits", "path tracer, max hits"};
+	int hits[3] = {maxHits, maxHits, maxHits + 1};
+	for (int i = 0; i < 3; i++)
+	{
+		cfg.maxHits = hits[i];
+		setConfig(cfg);
+		if (i == 1)
+			stats.push_back(FrameStats(renderFrames(pool, scene, true, TEST_SIZE, frames)));
+		else
+			stats.push_back(renderPathTracer(pool, scene, frames));
+		printf("%s %d: %.5f +- %.5f\n", names[i], hits[i], stats[i].mean, stats[i].error);
+	}
+
+	const FrameStats& lower = stats[0];
+	const FrameStats& bidir = stats[1];
+	const FrameStats& upper = stats[2];
+	bool ok = bidir.mean >= lower.mean - TEST_SIGMAS*hypot(lower.error, bidir.error) &&
+		bidir.mean <= upper.mean + TEST_SIGMAS*hypot(upper.error, bidir.error);
+	printf(ok ? "BDPT within the noise of the path tracer\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+/**
+ * @file Bvh.cpp
+ * @author
+ * @brief Contains the binned SAH builder of the BVH
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <cfloat>
+
+#include "Bvh.hpp"
+#include "Scene.hpp"
+
+using namespace std;
+
+/**
+ * @brief Returns half the surface area of the box, enough for comparing SAH costs
+ *
+ */
+static float halfArea(vec3 bmin, vec3 bmax)
+{
+	vec3 d = glm::max(bmax - bmin, vec3(0.0f));
+	return d.x*d.y + d.y*d.z + d.z*d.x;
+}
+
+/**
+ * @brief Temporary per primitive data used while building
+ *
+ */
+struct BuildPrim
+{
+	vec3 bmin;
+	vec3 bmax;
+	vec3 centroid;
+	uint32_t ref;
+};
+
+/**
+ * @brief Recursively splits prims [begin, end) below the given node.
+ *
+ */
+static void buildNode(vector<BvhNode>& nodes, vector<BuildPrim>& bp, int node, int begin, int end, int depth)
+{
+	vec3 bmin = vec3(FLT_MAX), bmax = vec3(-FLT_MAX), cmin = vec3(FLT_MAX), cmax = vec3(-FLT_MAX);
+	for (int i = begin; i < end; i++)
+	{
+		bmin = glm::min(bmin, bp[i].bmin);
+		bmax = glm::max(bmax, bp[i].bmax);
+		cmin = glm::min(cmin, bp[i].centroid);
+		cmax = glm::max(cmax, bp[i].centroid);
+	}
+	nodes[node].bmin = bmin;
+	nodes[node].bmax = bmax;
+	nodes[node].first = begin;
+	nodes[node].count = end - begin;
+	int count = end - begin;
+	if (count <= 1 || depth >= BVH_MAX_DEPTH)
+		return;
+
+	/* Find the cheapest bin boundary over all three axes */
+	float bestCost = FLT_MAX;
+	int bestAxis = -1, bestBin = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = cmax[axis] - cmin[axis];
+		if (extent <= 1e-6f)
+			continue;
+		int binCount[BVH_BINS] = {0};
+		vec3 binMin[BVH_BINS], binMax[BVH_BINS];
+		for (int b = 0; b < BVH_BINS; b++)
+		{
+			binMin[b] = vec3(FLT_MAX);
+			binMax[b] = vec3(-FLT_MAX);
+		}
+		float scale = BVH_BINS/extent;
+		for (int i = begin; i < end; i++)
+		{
+			int b = min(BVH_BINS - 1, int((bp[i].centroid[axis] - cmin[axis])*scale));
+			binCount[b]++;
+			binMin[b] = glm::min(binMin[b], bp[i].bmin);
+			binMax[b] = glm::max(binMax[b], bp[i].bmax);
+		}
+		/* Sweep from the right to get the cost of every right side, then from the left */
+		float rightCost[BVH_BINS];
+		vec3 rmin = vec3(FLT_MAX), rmax = vec3(-FLT_MAX);
+		int rcount = 0;
+		for (int b = BVH_BINS - 1; b > 0; b--)
+		{
+			rmin = glm::min(rmin, binMin[b]);
+			rmax = glm::max(rmax, binMax[b]);
+			rcount += binCount[b];
+			rightCost[b] = rcount ? rcount*halfArea(rmin, rmax) : 0.0f;
+		}
+		vec3 lmin = vec3(FLT_MAX), lmax = vec3(-FLT_MAX);
+		int lcount = 0;
+		for (int b = 0; b < BVH_BINS - 1; b++)
+		{
+			lmin = glm::min(lmin, binMin[b]);
+			lmax = glm::max(lmax, binMax[b]);
+			lcount += binCount[b];
+			if (lcount == 0 || lcount == count)
+				continue;
+			float cost = lcount*halfArea(lmin, lmax) + rightCost[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	/* Traversal step costs as much as one primitive test */
+	float area = halfArea(bmin, bmax);
+	float leafCost = count*area;
+	int mid;
+	if (bestAxis >= 0 && (count > BVH_MAX_LEAF || area + bestCost < leafCost))
+	{
+		float scale = BVH_BINS/(cmax[bestAxis] - cmin[bestAxis]);
+		float lo = cmin[bestAxis];
+		int axis = bestAxis, split = bestBin;
+		mid = int(partition(bp.begin() + begin, bp.begin() + end, [=](const BuildPrim& p)
+			{ return min(BVH_BINS - 1, int((p.centroid[axis] - lo)*scale)) <= split; }) - bp.begin());
+	}
+	else if (count > BVH_MAX_LEAF)
+		mid = (begin + end)/2;
+	else
+		return;
+
+	int left = (int)nodes.size();
+	nodes.push_back(BvhNode());
+	nodes.push_back(BvhNode());
+	nodes[node].first = left;
+	nodes[node].count = 0;
+	buildNode(nodes, bp, left, begin, mid, depth + 1);
+	buildNode(nodes, bp, left + 1, mid, end, depth + 1);
+}
+
+void Bvh::build(const Scene& scene)
+{
+	vector<BuildPrim> bp;
+	bp.reserve(scene.numSpheres() + scene.numTriangles());
+	for (int i = 0; i < scene.numSpheres(); i++)
+	{
+		BuildPrim p;
+		vec3 r = vec3(scene.sphRad[i]);
+		p.bmin = scene.sphPos[i] - r;
+		p.bmax = scene.sphPos[i] + r;
+		p.centroid = scene.sphPos[i];
+		p.ref = uint32_t(i) | BVH_SPHERE_BIT;
+		bp.push_back(p);
+	}
+	for (int i = 0; i < scene.numTriangles(); i++)
+	{
+		BuildPrim p;
+		vec3 v0 = scene.tglVert0[i], v1 = v0 + scene.tglEdge1[i], v2 = v0 + scene.tglEdge2[i];
+		p.bmin = glm::min(v0, glm::min(v1, v2));
+		p.bmax = glm::max(v0, glm::max(v1, v2));
+		p.centroid = (p.bmin + p.bmax)*0.5f;
+		p.ref = uint32_t(i);
+		bp.push_back(p);
+	}
+
+	nodes.clear();
+	prims.clear();
+	if (bp.empty())
+		return;
+	nodes.reserve(2*bp.size());
+	nodes.push_back(BvhNode());
+	buildNode(nodes, bp, 0, 0, (int)bp.size(), 0);
+	prims.resize(bp.size());
+	for (size_t i = 0; i < bp.size(); i++)
+		prims[i] = bp[i].ref;
+}
+
+/**
+ * @brief Returns the depth of the subtree below the given node
+ *
+ */
+static int nodeDepth(const vector<BvhNode>& nodes, int node)
+{
+	if (nodes[node].count > 0)
+		return 1;
+	return 1 + max(nodeDepth(nodes, nodes[node].first), nodeDepth(nodes, nodes[node].first + 1));
+}
+
+int Bvh::depth() const
+{
+	return nodes.empty() ? 0 : nodeDepth(nodes, 0);
+}
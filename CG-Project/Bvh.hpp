@@ -0,0 +1,60 @@
+#pragma once
+
+/**
+ * @file Bvh.hpp
+ * @author
+ * @brief Contains the bounding volume hierarchy over the spheres and triangles of a Scene
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include "MltPixel.hpp"
+
+#define BVH_BINS 16
+#define BVH_MAX_LEAF 8
+#define BVH_MAX_DEPTH 60
+
+/* Set in a primitive reference for spheres, clear for triangles */
+#define BVH_SPHERE_BIT 0x80000000u
+
+struct Scene;
+
+/**
+ * @brief Struct for a single node of the BVH. Interior nodes (count == 0) store the index
+ * of their left child in first, the right child directly follows it. Leaves store the range
+ * [first, first + count) of the primitive references.
+ *
+ */
+struct BvhNode
+{
+	vec3 bmin;
+	int first;
+	vec3 bmax;
+	int count;
+};
+
+/**
+ * @brief Struct containing a binary BVH built with the binned Surface Area Heuristic
+ *
+ */
+struct Bvh
+{
+	std::vector<BvhNode> nodes;
+	std::vector<uint32_t> prims;
+
+	/**
+	 * @brief Builds the hierarchy over every sphere and triangle of the scene.
+	 * Planes are infinite and stay outside the hierarchy.
+	 *
+	 * @param scene Scene to build the hierarchy for
+	 */
+	void build(const Scene& scene);
+
+	int depth() const;
+};
@@ -0,0 +1,447 @@
+/**
+ * @file Bvh8.cpp
+ * @author
+ * @brief Contains the builder of the 8-wide BVH and its AVX2/scalar node and triangle kernels
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <cfloat>
+#include <cmath>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "Bvh.hpp"
+#include "Bvh8.hpp"
+#include "Scene.hpp"
+
+using namespace std;
+
+/* The scalar kernels must round exactly like the AVX2 ones, so no fused multiply-adds */
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+/**
+ * @brief Returns half the surface area of a binary node's box
+ *
+ */
+static float nodeArea(const BvhNode& n)
+{
+	vec3 d = n.bmax - n.bmin;
+	return d.x*d.y + d.y*d.z + d.z*d.x;
+}
+
+/**
+ * @brief Struct for the contiguous range of primitive references below a binary node
+ *
+ */
+struct PrimRange
+{
+	int first;
+	int count;
+};
+
+/**
+ * @brief Fills the primitive range of every binary node. The builder partitions the
+ * references in place, so every subtree owns one contiguous range.
+ *
+ */
+static PrimRange primRanges(const Bvh& bvh, int node, std::vector<PrimRange>& ranges)
+{
+	const BvhNode& n = bvh.nodes[node];
+	PrimRange r = {n.first, n.count};
+	if (n.count == 0)
+	{
+		PrimRange left = primRanges(bvh, n.first, ranges), right = primRanges(bvh, n.first + 1, ranges);
+		r.first = left.first;
+		r.count = left.count + right.count;
+	}
+	ranges[node] = r;
+	return r;
+}
+
+/**
+ * @brief Turns the primitives below a binary node into a wide leaf
+ *
+ */
+static int makeLeaf(Bvh8& wide, const Bvh& bvh, const Scene& scene, PrimRange r)
+{
+	Bvh8Leaf leaf;
+	leaf.firstPacket = (int)wide.packets.size();
+	leaf.firstSph = (int)wide.sphs.size();
+	int lane = BVH8_WIDTH;
+	for (int i = r.first; i < r.first + r.count; i++)
+	{
+		uint32_t ref = bvh.prims[i];
+		if (ref & BVH_SPHERE_BIT)
+		{
+			wide.sphs.push_back(int(ref & ~BVH_SPHERE_BIT));
+			continue;
+		}
+		if (lane == BVH8_WIDTH)
+		{
+			TglPacket p = {};
+			for (int l = 0; l < BVH8_WIDTH; l++)
+				p.id[l] = -1;
+			wide.packets.push_back(p);
+			lane = 0;
+		}
+		TglPacket& p = wide.packets.back();
+		int tgl = int(ref);
+		vec3 v0 = scene.tglVert0[tgl], e1 = scene.tglEdge1[tgl], e2 = scene.tglEdge2[tgl];
+		p.vert0X[lane] = v0.x;
+		p.vert0Y[lane] = v0.y;
+		p.vert0Z[lane] = v0.z;
+		p.edge1X[lane] = e1.x;
+		p.edge1Y[lane] = e1.y;
+		p.edge1Z[lane] = e1.z;
+		p.edge2X[lane] = e2.x;
+		p.edge2Y[lane] = e2.y;
+		p.edge2Z[lane] = e2.z;
+		p.id[lane] = tgl;
+		lane++;
+	}
+	leaf.numPackets = (int)wide.packets.size() - leaf.firstPacket;
+	leaf.numSph = (int)wide.sphs.size() - leaf.firstSph;
+	wide.leaves.push_back(leaf);
+	return (int)wide.leaves.size() - 1;
+}
+
+/**
+ * @brief Returns whether the binary node becomes a wide leaf: binary leaves, which the
+ * builder leaves larger than 8 primitives at BVH_MAX_DEPTH or when no split pays off,
+ * and subtrees with at most 8 primitives, so that their triangles fill one packet
+ * instead of several sparse ones
+ *
+ */
+static bool wideLeaf(const Bvh& bvh, const std::vector<PrimRange>& ranges, int binNode)
+{
+	return bvh.nodes[binNode].count > 0 || ranges[binNode].count <= BVH8_WIDTH;
+}
+
+/**
+ * @brief Creates the wide node for the binary subtree below the given node and returns
+ * its index
+ *
+ */
+static int collapse(Bvh8& wide, const Bvh& bvh, const Scene& scene, const std::vector<PrimRange>& ranges, int binNode)
+{
+	int kids[BVH8_WIDTH], numKids = 0;
+	const BvhNode& root = bvh.nodes[binNode];
+	if (wideLeaf(bvh, ranges, binNode))
+		kids[numKids++] = binNode;
+	else
+	{
+		kids[numKids++] = root.first;
+		kids[numKids++] = root.first + 1;
+	}
+	/* Open the largest interior child until all slots are used */
+	while (numKids < BVH8_WIDTH)
+	{
+		int best = -1;
+		float bestArea = -1;
+		for (int i = 0; i < numKids; i++)
+		{
+			const BvhNode& n = bvh.nodes[kids[i]];
+			if (!wideLeaf(bvh, ranges, kids[i]) && nodeArea(n) > bestArea)
+			{
+				best = i;
+				bestArea = nodeArea(n);
+			}
+		}
+		if (best < 0)
+			break;
+		int opened = kids[best];
+		kids[best] = bvh.nodes[opened].first;
+		kids[numKids++] = bvh.nodes[opened].first + 1;
+	}
+
+	int index = (int)wide.nodes.size();
+	wide.nodes.push_back(Bvh8Node());
+	Bvh8Node node;
+	for (int i = 0; i < BVH8_WIDTH; i++)
+	{
+		node.bminX[i] = node.bminY[i] = node.bminZ[i] = FLT_MAX;
+		node.bmaxX[i] = node.bmaxY[i] = node.bmaxZ[i] = -FLT_MAX;
+		node.child[i] = BVH8_EMPTY;
+	}
+	for (int i = 0; i < numKids; i++)
+	{
+		const BvhNode& n = bvh.nodes[kids[i]];
+		node.bminX[i] = n.bmin.x;
+		node.bminY[i] = n.bmin.y;
+		node.bminZ[i] = n.bmin.z;
+		node.bmaxX[i] = n.bmax.x;
+		node.bmaxY[i] = n.bmax.y;
+		node.bmaxZ[i] = n.bmax.z;
+		if (wideLeaf(bvh, ranges, kids[i]))
+			node.child[i] = ~makeLeaf(wide, bvh, scene, ranges[kids[i]]);
+		else
+			node.child[i] = collapse(wide, bvh, scene, ranges, kids[i]);
+	}
+	wide.nodes[index] = node;
+	return index;
+}
+
+void Bvh8::build(const Bvh& bvh, const Scene& scene)
+{
+	nodes.clear();
+	leaves.clear();
+	packets.clear();
+	sphs.clear();
+	if (bvh.nodes.empty())
+		return;
+	vector<PrimRange> ranges(bvh.nodes.size());
+	primRanges(bvh, 0, ranges);
+	collapse(*this, bvh, scene, ranges, 0);
+}
+
+/* Same operand order and NaN behaviour as _mm256_min_ps/_mm256_max_ps */
+static inline float minps(float a, float b)
+{
+	return a < b ? a : b;
+}
+
+static inline float maxps(float a, float b)
+{
+	return a > b ? a : b;
+}
+
+int intersectBvh8NodeScalar(vec3 org, vec3 invDir, const Bvh8Node& node, float tMax, float tEnter[BVH8_WIDTH])
+{
+	int mask = 0;
+	for (int i = 0; i < BVH8_WIDTH; i++)
+	{
+		float t0x = (node.bminX[i] - org.x)*invDir.x, t1x = (node.bmaxX[i] - org.x)*invDir.x;
+		float t0y = (node.bminY[i] - org.y)*invDir.y, t1y = (node.bmaxY[i] - org.y)*invDir.y;
+		float t0z = (node.bminZ[i] - org.z)*invDir.z, t1z = (node.bmaxZ[i] - org.z)*invDir.z;
+		float tNear = maxps(maxps(minps(t0x, t1x), minps(t0y, t1y)), maxps(minps(t0z, t1z), 0.0f));
+		float tFar = minps(minps(maxps(t0x, t1x), maxps(t0y, t1y)), minps(maxps(t0z, t1z), tMax));
+		tEnter[i] = tNear;
+		if (tNear <= tFar && node.child[i] != BVH8_EMPTY)
+			mask |= 1 << i;
+	}
+	return mask;
+}
+
+int intersectTglPacketScalar(vec3 org, vec3 dir, const TglPacket& p, float tMax, float& t, bool twoSided)
+{
+	int hit = -1;
+	for (int i = 0; i < BVH8_WIDTH; i++)
+	{
+		float px = dir.y*p.edge2Z[i] - dir.z*p.edge2Y[i];
+		float py = dir.z*p.edge2X[i] - dir.x*p.edge2Z[i];
+		float pz = dir.x*p.edge2Y[i] - dir.y*p.edge2X[i];
+		float det = p.edge1X[i]*px + p.edge1Y[i]*py + p.edge1Z[i]*pz;
+		float invDet = 1.0f/det;
+		float tx = org.x - p.vert0X[i], ty = org.y - p.vert0Y[i], tz = org.z - p.vert0Z[i];
+		float u = (tx*px + ty*py + tz*pz)*invDet;
+		float qx = ty*p.edge1Z[i] - tz*p.edge1Y[i];
+		float qy = tz*p.edge1X[i] - tx*p.edge1Z[i];
+		float qz = tx*p.edge1Y[i] - ty*p.edge1X[i];
+		float v = (dir.x*qx + dir.y*qy + dir.z*qz)*invDet;
+		float tHit = (p.edge2X[i]*qx + p.edge2Y[i]*qy + p.edge2Z[i]*qz)*invDet;
+		float facing = twoSided ? fabsf(det) : det;
+		if (facing >= 0.001f && u >= 0.0f && u <= 1.0f && v >= 0.0f && u + v <= 1.0f && tHit > 0.0f && tHit < tMax)
+		{
+			tMax = tHit;
+			hit = i;
+		}
+	}
+	if (hit >= 0)
+		t = tMax;
+	return hit;
+}
+
+int intersectAabbPacketScalar(const RayPacket& rays, const Bvh8Node& node, int slot, const float tMax[BVH8_WIDTH], float tEnter[BVH8_WIDTH])
+{
+	int mask = 0;
+	for (int i = 0; i < BVH8_WIDTH; i++)
+	{
+		float t0x = (node.bminX[slot] - rays.orgX[i])*rays.invDirX[i], t1x = (node.bmaxX[slot] - rays.orgX[i])*rays.invDirX[i];
+		float t0y = (node.bminY[slot] - rays.orgY[i])*rays.invDirY[i], t1y = (node.bmaxY[slot] - rays.orgY[i])*rays.invDirY[i];
+		float t0z = (node.bminZ[slot] - rays.orgZ[i])*rays.invDirZ[i], t1z = (node.bmaxZ[slot] - rays.orgZ[i])*rays.invDirZ[i];
+		float tNear = maxps(maxps(minps(t0x, t1x), minps(t0y, t1y)), maxps(minps(t0z, t1z), 0.0f));
+		float tFar = minps(minps(maxps(t0x, t1x), maxps(t0y, t1y)), minps(maxps(t0z, t1z), tMax[i]));
+		tEnter[i] = tNear;
+		if (tNear <= tFar)
+			mask |= 1 << i;
+	}
+	return mask;
+}
+
+int intersectTglRaysScalar(const RayPacket& rays, const TglPacket& p, int lane, float tMax[BVH8_WIDTH])
+{
+	int mask = 0;
+	for (int i = 0; i < BVH8_WIDTH; i++)
+	{
+		float px = rays.dirY[i]*p.edge2Z[lane] - rays.dirZ[i]*p.edge2Y[lane];
+		float py = rays.dirZ[i]*p.edge2X[lane] - rays.dirX[i]*p.edge2Z[lane];
+		float pz = rays.dirX[i]*p.edge2Y[lane] - rays.dirY[i]*p.edge2X[lane];
+		float det = p.edge1X[lane]*px + p.edge1Y[lane]*py + p.edge1Z[lane]*pz;
+		float invDet = 1.0f/det;
+		float tx = rays.orgX[i] - p.vert0X[lane], ty = rays.orgY[i] - p.vert0Y[lane], tz = rays.orgZ[i] - p.vert0Z[lane];
+		float u = (tx*px + ty*py + tz*pz)*invDet;
+		float qx = ty*p.edge1Z[lane] - tz*p.edge1Y[lane];
+		float qy = tz*p.edge1X[lane] - tx*p.edge1Z[lane];
+		float qz = tx*p.edge1Y[lane] - ty*p.edge1X[lane];
+		float v = (rays.dirX[i]*qx + rays.dirY[i]*qy + rays.dirZ[i]*qz)*invDet;
+		float tHit = (p.edge2X[lane]*qx + p.edge2Y[lane]*qy + p.edge2Z[lane]*qz)*invDet;
+		if (det >= 0.001f && u >= 0.0f && u <= 1.0f && v >= 0.0f && u + v <= 1.0f && tHit > 0.0f && tHit < tMax[i])
+		{
+			tMax[i] = tHit;
+			mask |= 1 << i;
+		}
+	}
+	return mask;
+}
+
+#ifdef __AVX2__
+
+int intersectTglRays(const RayPacket& rays, const TglPacket& p, int lane, float tMax[BVH8_WIDTH])
+{
+	__m256 dx = _mm256_load_ps(rays.dirX), dy = _mm256_load_ps(rays.dirY), dz = _mm256_load_ps(rays.dirZ);
+	__m256 e1x = _mm256_set1_ps(p.edge1X[lane]), e1y = _mm256_set1_ps(p.edge1Y[lane]), e1z = _mm256_set1_ps(p.edge1Z[lane]);
+	__m256 e2x = _mm256_set1_ps(p.edge2X[lane]), e2y = _mm256_set1_ps(p.edge2Y[lane]), e2z = _mm256_set1_ps(p.edge2Z[lane]);
+	__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+	__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+	__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+	__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+	__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+	__m256 tx = _mm256_sub_ps(_mm256_load_ps(rays.orgX), _mm256_set1_ps(p.vert0X[lane]));
+	__m256 ty = _mm256_sub_ps(_mm256_load_ps(rays.orgY), _mm256_set1_ps(p.vert0Y[lane]));
+	__m256 tz = _mm256_sub_ps(_mm256_load_ps(rays.orgZ), _mm256_set1_ps(p.vert0Z[lane]));
+	__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), invDet);
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+	__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+	__m256 tHit = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+	__m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), limit = _mm256_loadu_ps(tMax);
+	__m256 valid = _mm256_cmp_ps(det, _mm256_set1_ps(0.001f), _CMP_GE_OQ);
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(tHit, zero, _CMP_GT_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(tHit, limit, _CMP_LT_OQ));
+	_mm256_storeu_ps(tMax, _mm256_blendv_ps(limit, tHit, valid));
+	return _mm256_movemask_ps(valid);
+}
+
+int intersectAabbPacket(const RayPacket& rays, const Bvh8Node& node, int slot, const float tMax[BVH8_WIDTH], float tEnter[BVH8_WIDTH])
+{
+	__m256 ox = _mm256_load_ps(rays.orgX), oy = _mm256_load_ps(rays.orgY), oz = _mm256_load_ps(rays.orgZ);
+	__m256 ix = _mm256_load_ps(rays.invDirX), iy = _mm256_load_ps(rays.invDirY), iz = _mm256_load_ps(rays.invDirZ);
+	__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bminX[slot]), ox), ix);
+	__m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bmaxX[slot]), ox), ix);
+	__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bminY[slot]), oy), iy);
+	__m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bmaxY[slot]), oy), iy);
+	__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bminZ[slot]), oz), iz);
+	__m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.bmaxZ[slot]), oz), iz);
+	__m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)),
+		_mm256_max_ps(_mm256_min_ps(t0z, t1z), _mm256_setzero_ps()));
+	__m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)),
+		_mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_loadu_ps(tMax)));
+	_mm256_storeu_ps(tEnter, tNear);
+	return _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+}
+
+int intersectBvh8Node(vec3 org, vec3 invDir, const Bvh8Node& node, float tMax, float tEnter[BVH8_WIDTH])
+{
+	__m256 ox = _mm256_set1_ps(org.x), oy = _mm256_set1_ps(org.y), oz = _mm256_set1_ps(org.z);
+	__m256 ix = _mm256_set1_ps(invDir.x), iy = _mm256_set1_ps(invDir.y), iz = _mm256_set1_ps(invDir.z);
+	__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminX), ox), ix);
+	__m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxX), ox), ix);
+	__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminY), oy), iy);
+	__m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxY), oy), iy);
+	__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminZ), oz), iz);
+	__m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxZ), oz), iz);
+	__m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)),
+		_mm256_max_ps(_mm256_min_ps(t0z, t1z), _mm256_setzero_ps()));
+	__m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)),
+		_mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_set1_ps(tMax)));
+	_mm256_storeu_ps(tEnter, tNear);
+	__m256i empty = _mm256_cmpeq_epi32(_mm256_load_si256((const __m256i*)node.child), _mm256_set1_epi32(BVH8_EMPTY));
+	__m256 hit = _mm256_andnot_ps(_mm256_castsi256_ps(empty), _mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+	return _mm256_movemask_ps(hit);
+}
+
+int intersectTglPacket(vec3 org, vec3 dir, const TglPacket& p, float tMax, float& t, bool twoSided)
+{
+	__m256 dx = _mm256_set1_ps(dir.x), dy = _mm256_set1_ps(dir.y), dz = _mm256_set1_ps(dir.z);
+	__m256 e1x = _mm256_load_ps(p.edge1X), e1y = _mm256_load_ps(p.edge1Y), e1z = _mm256_load_ps(p.edge1Z);
+	__m256 e2x = _mm256_load_ps(p.edge2X), e2y = _mm256_load_ps(p.edge2Y), e2z = _mm256_load_ps(p.edge2Z);
+	__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+	__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+	__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+	__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+	__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+	__m256 tx = _mm256_sub_ps(_mm256_set1_ps(org.x), _mm256_load_ps(p.vert0X));
+	__m256 ty = _mm256_sub_ps(_mm256_set1_ps(org.y), _mm256_load_ps(p.vert0Y));
+	__m256 tz = _mm256_sub_ps(_mm256_set1_ps(org.z), _mm256_load_ps(p.vert0Z));
+	__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), invDet);
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+	__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+	__m256 tHit = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+	__m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), limit = _mm256_set1_ps(tMax);
+	__m256 facing = twoSided ? _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det) : det;
+	__m256 valid = _mm256_cmp_ps(facing, _mm256_set1_ps(0.001f), _CMP_GE_OQ);
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(tHit, zero, _CMP_GT_OQ));
+	valid = _mm256_and_ps(valid, _mm256_cmp_ps(tHit, limit, _CMP_LT_OQ));
+	int mask = _mm256_movemask_ps(valid);
+	if (!mask)
+		return -1;
+
+	/* Horizontal minimum of the valid distances, ties go to the lowest lane like the scalar loop */
+	__m256 tm = _mm256_blendv_ps(limit, tHit, valid);
+	__m256 m = _mm256_min_ps(tm, _mm256_permute2f128_ps(tm, tm, 1));
+	m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+	m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+	mask &= _mm256_movemask_ps(_mm256_cmp_ps(tm, m, _CMP_EQ_OQ));
+	int lane = 0;
+	while (!(mask & (1 << lane)))
+		lane++;
+	t = _mm256_cvtss_f32(m);
+	return lane;
+}
+
+#else
+
+int intersectTglRays(const RayPacket& rays, const TglPacket& p, int lane, float tMax[BVH8_WIDTH])
+{
+	return intersectTglRaysScalar(rays, p, lane, tMax);
+}
+
+int intersectAabbPacket(const RayPacket& rays, const Bvh8Node& node, int slot, const float tMax[BVH8_WIDTH], float tEnter[BVH8_WIDTH])
+{
+	return intersectAabbPacketScalar(rays, node, slot, tMax, tEnter);
+}
+
+int intersectBvh8Node(vec3 org, vec3 invDir, const Bvh8Node& node, float tMax, float tEnter[BVH8_WIDTH])
+{
+	return intersectBvh8NodeScalar(org, invDir, node, tMax, tEnter);
+}
+
+int intersectTglPacket(vec3 org, vec3 dir, const TglPacket& p, float tMax, float& t, bool twoSided)
+{
+	return intersectTglPacketScalar(org, dir, p, tMax, t, twoSided);
+}
+
+#endif
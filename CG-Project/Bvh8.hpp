@@ -0,0 +1,238 @@
+#pragma once
+
+/**
+ * @file Bvh8.hpp
+ * @author
+ * @brief Contains the 8-wide BVH collapsed from the binary BVH, traversed with AVX2
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include "Bvh.hpp"
+#include "MltPixel.hpp"
+
+#define BVH8_WIDTH 8
+/*
+ * A wide node only collapses interior binary nodes, so the wide tree is at most
+ * BVH_MAX_DEPTH levels deep, and every node popped pushes at most 8 children
+ */
+#define BVH8_STACK_SIZE (1 + (BVH8_WIDTH - 1)*BVH_MAX_DEPTH)
+
+/* Child slot holding no box */
+#define BVH8_EMPTY 0x7fffffff
+
+struct Scene;
+
+/**
+ * @brief Minimal allocator returning 32 byte aligned storage, so that std::vector keeps the
+ * alignment of the SIMD node and packet types (which C++14 operator new does not).
+ *
+ */
+template <class T>
+struct AlignedAlloc
+{
+	typedef T value_type;
+
+	AlignedAlloc() = default;
+	template <class U>
+	AlignedAlloc(const AlignedAlloc<U>&)
+	{}
+
+	T* allocate(std::size_t n)
+	{
+		/* Over-allocate and keep the original pointer just before the aligned block */
+		char* raw = static_cast<char*>(::operator new(n*sizeof(T) + 32 + sizeof(void*)));
+		std::uintptr_t p = (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*) + 31) & ~std::uintptr_t(31);
+		reinterpret_cast<void**>(p)[-1] = raw;
+		return reinterpret_cast<T*>(p);
+	}
+
+	void deallocate(T* p, std::size_t)
+	{
+		::operator delete(reinterpret_cast<void**>(p)[-1]);
+	}
+
+	template <class U>
+	bool operator==(const AlignedAlloc<U>&) const
+	{
+		return true;
+	}
+
+	template <class U>
+	bool operator!=(const AlignedAlloc<U>&) const
+	{
+		return false;
+	}
+};
+
+/**
+ * @brief Struct for a single 8-wide node. The child boxes are stored as structure of arrays
+ * so one AVX2 slab test covers all of them. A child >= 0 is another node, a child < 0 is
+ * the leaf ~child and unused slots hold BVH8_EMPTY with an inverted box.
+ *
+ */
+struct alignas(32) Bvh8Node
+{
+	float bminX[BVH8_WIDTH];
+	float bminY[BVH8_WIDTH];
+	float bminZ[BVH8_WIDTH];
+	float bmaxX[BVH8_WIDTH];
+	float bmaxY[BVH8_WIDTH];
+	float bmaxZ[BVH8_WIDTH];
+	int child[BVH8_WIDTH];
+};
+
+/**
+ * @brief Struct for a batch of up to 8 triangles in structure of arrays layout.
+ * Unused lanes have zero edges, which every intersection test rejects, and id -1.
+ *
+ */
+struct alignas(32) TglPacket
+{
+	float vert0X[BVH8_WIDTH];
+	float vert0Y[BVH8_WIDTH];
+	float vert0Z[BVH8_WIDTH];
+	float edge1X[BVH8_WIDTH];
+	float edge1Y[BVH8_WIDTH];
+	float edge1Z[BVH8_WIDTH];
+	float edge2X[BVH8_WIDTH];
+	float edge2Y[BVH8_WIDTH];
+	float edge2Z[BVH8_WIDTH];
+	int id[BVH8_WIDTH];
+};
+
+/**
+ * @brief Struct for up to 8 coherent rays in structure of arrays layout, traced together
+ *
+ */
+struct alignas(32) RayPacket
+{
+	float orgX[BVH8_WIDTH];
+	float orgY[BVH8_WIDTH];
+	float orgZ[BVH8_WIDTH];
+	float invDirX[BVH8_WIDTH];
+	float invDirY[BVH8_WIDTH];
+	float invDirZ[BVH8_WIDTH];
+	float dirX[BVH8_WIDTH];
+	float dirY[BVH8_WIDTH];
+	float dirZ[BVH8_WIDTH];
+};
+
+/**
+ * @brief Struct for a leaf of the wide BVH: a range of triangle packets and a range of spheres
+ *
+ */
+struct Bvh8Leaf
+{
+	int firstPacket;
+	int numPackets;
+	int firstSph;
+	int numSph;
+};
+
+/**
+ * @brief Struct containing the 8-wide BVH. Node 0 is the root.
+ *
+ */
+struct Bvh8
+{
+	std::vector<Bvh8Node, AlignedAlloc<Bvh8Node>> nodes;
+	std::vector<Bvh8Leaf> leaves;
+	std::vector<TglPacket, AlignedAlloc<TglPacket>> packets;
+	std::vector<int> sphs;
+
+	/**
+	 * @brief Collapses the binary BVH into 8-wide nodes, repeatedly opening the
+	 * largest interior child until every node has up to 8 children.
+	 *
+	 * @param bvh Binary BVH built over the scene
+	 * @param scene Scene the binary BVH was built for
+	 */
+	void build(const Bvh& bvh, const Scene& scene);
+};
+
+/**
+ * @brief Tests a ray against the 8 triangles of a packet, one lane per triangle,
+ * using the Moller-Trumbore test of intersectTgl_MT97.
+ *
+ * @param org Origin of the ray
+ * @param dir Direction of the ray
+ * @param packet Triangles to test
+ * @param tMax Only hits closer than tMax are reported
+ * @param t Distance of the closest hit in case of intersection
+ * @param twoSided Also hit triangles from behind, whose vertices the ray sees clockwise
+ * @return int Lane of the closest hit triangle, or -1
+ */
+int intersectTglPacket(vec3 org, vec3 dir, const TglPacket& packet, float tMax, float& t, bool twoSided = false);
+
+/**
+ * @brief Scalar version of intersectTglPacket() which returns identical hits
+ * on machines without AVX2.
+ *
+ */
+int intersectTglPacketScalar(vec3 org, vec3 dir, const TglPacket& packet, float tMax, float& t, bool twoSided = false);
+
+/**
+ * @brief Slab tests a ray against the 8 child boxes of a node.
+ *
+ * @param org Origin of the ray
+ * @param invDir Componentwise inverse of the ray direction
+ * @param node Node whose children are tested
+ * @param tMax Boxes entered beyond tMax count as missed
+ * @param tEnter Entry distance into every child box
+ * @return int Bitmask of the children hit
+ */
+int intersectBvh8Node(vec3 org, vec3 invDir, const Bvh8Node& node, float tMax, float tEnter[BVH8_WIDTH]);
+
+/**
+ * @brief Scalar version of intersectBvh8Node() which returns identical masks
+ * on machines without AVX2.
+ *
+ */
+int intersectBvh8NodeScalar(vec3 org, vec3 invDir, const Bvh8Node& node, float tMax, float tEnter[BVH8_WIDTH]);
+
+/**
+ * @brief Slab tests the 8 rays of a packet against one child box of a node.
+ *
+ * @param rays Rays to test
+ * @param node Node holding the box
+ * @param slot Child slot of the box in the node
+ * @param tMax Per ray limit, a negative limit disables the lane
+ * @param tEnter Entry distance of every ray into the box
+ * @return int Bitmask of the rays hitting the box
+ */
+int intersectAabbPacket(const RayPacket& rays, const Bvh8Node& node, int slot, const float tMax[BVH8_WIDTH], float tEnter[BVH8_WIDTH]);
+
+/**
+ * @brief Scalar version of intersectAabbPacket() which returns identical masks
+ * on machines without AVX2.
+ *
+ */
+int intersectAabbPacketScalar(const RayPacket& rays, const Bvh8Node& node, int slot, const float tMax[BVH8_WIDTH], float tEnter[BVH8_WIDTH]);
+
+/**
+ * @brief Tests the 8 rays of a packet against one triangle of a triangle packet, one lane
+ * per ray, using the same arithmetic as intersectTglPacket().
+ *
+ * @param rays Rays to test
+ * @param packet Triangle packet
+ * @param lane Triangle of the packet to test
+ * @param tMax Per ray limit, updated with the distance of every closer hit
+ * @return int Bitmask of the rays which hit the triangle closer than before
+ */
+int intersectTglRays(const RayPacket& rays, const TglPacket& packet, int lane, float tMax[BVH8_WIDTH]);
+
+/**
+ * @brief Scalar version of intersectTglRays() which returns identical hits
+ * on machines without AVX2.
+ *
+ */
+int intersectTglRaysScalar(const RayPacket& rays, const TglPacket& packet, int lane, float tMax[BVH8_WIDTH]);
@@ -0,0 +1,168 @@
+/**
+ * @file DisplayFormat.cpp
+ * @author
+ * @brief Contains the AVX2/scalar conversions into the display formats
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "glm/gtc/packing.hpp"
+
+#include "DisplayFormat.hpp"
+
+using namespace std;
+
+/* F16C ships with every AVX2 CPU, but GCC and Clang only enable it on request */
+#if defined(__AVX2__) && (defined(__F16C__) || defined(_MSC_VER))
+#define DISPLAY_F16C 1
+#endif
+
+int parseDisplayFormat(const char* name)
+{
+	if (!strcmp(name, "rgba32f"))
+		return DISPLAY_RGBA32F;
+	if (!strcmp(name, "rgba16f"))
+		return DISPLAY_RGBA16F;
+	if (!strcmp(name, "rgb9e5"))
+		return DISPLAY_RGB9E5;
+	return -1;
+}
+
+int displayPixelSize(int format)
+{
+	switch (format)
+	{
+	case DISPLAY_RGBA16F:
+		return 8;
+	case DISPLAY_RGB9E5:
+		return 4;
+	default:
+		return 16;
+	}
+}
+
+/**
+ * @brief Converts pixels to half floats one at a time
+ *
+ */
+static void packHalfScalar(const vec4* src, uint64_t* dst, int n)
+{
+	for (int i = 0; i < n; i++)
+		dst[i] = packHalf4x16(src[i]);
+}
+
+/**
+ * @brief Converts pixels to the shared exponent format one at a time
+ *
+ */
+static void packRgb9e5Scalar(const vec4* src, uint32_t* dst, int n)
+{
+	for (int i = 0; i < n; i++)
+		dst[i] = packF3x9_E1x5(vec3(src[i]));
+}
+
+#ifdef __AVX2__
+
+#ifdef DISPLAY_F16C
+/**
+ * @brief Converts pixels to half floats two at a time. Rounds to nearest even, so only
+ * values exactly halfway between two halves differ from glm's packHalf4x16, which
+ * rounds those away from zero.
+ *
+ */
+static void packHalfAVX2(const vec4* src, uint64_t* dst, int n)
+{
+	int i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		__m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(&src[i].x), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i*)(dst + i), h);
+	}
+	packHalfScalar(src + i, dst + i, n - i);
+}
+#endif
+
+/**
+ * @brief Converts eight pixels at a time to the shared exponent format. The shared
+ * exponent is read from the float bits of the largest channel, where packF3x9_E1x5
+ * takes floor(log2()), and the channels are scaled by exact powers of two, so the
+ * encodings only differ where log2() rounds a value just below a power of two up to it.
+ *
+ */
+static void packRgb9e5AVX2(const vec4* src, uint32_t* dst, int n)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	/* packF3x9_E1x5 clamps to 2^8/2^9*2^16 */
+	const __m256 maxVal = _mm256_set1_ps(32768.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		/* Each register holds two pixels, transposing gives the pixels 0 2 4 6 1 3 5 7 */
+		const float* p = &src[i].x;
+		__m256 r0 = _mm256_loadu_ps(p), r1 = _mm256_loadu_ps(p + 8);
+		__m256 r2 = _mm256_loadu_ps(p + 16), r3 = _mm256_loadu_ps(p + 24);
+		__m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpackhi_ps(r0, r1);
+		__m256 t2 = _mm256_unpacklo_ps(r2, r3), t3 = _mm256_unpackhi_ps(r2, r3);
+		/* max(v, 0) turns NaNs into 0 */
+		__m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), zero), maxVal);
+		__m256 y = _mm256_min_ps(_mm256_max_ps(_mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2)), zero), maxVal);
+		__m256 z = _mm256_min_ps(_mm256_max_ps(_mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), zero), maxVal);
+		__m256 m = _mm256_max_ps(x, _mm256_max_ps(y, z));
+
+		/* exp = max(-16, floor(log2(m))) + 16, zeros and denormals give 0 */
+		__m256i e = _mm256_sub_epi32(_mm256_srli_epi32(_mm256_castps_si256(m), 23), _mm256_set1_epi32(127 - 16));
+		e = _mm256_max_epi32(e, _mm256_setzero_si256());
+		/* The channels become multiples of 2^(exp - 24), i.e. times 2^(24 - exp) */
+		__m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_sub_epi32(_mm256_set1_epi32(127 + 24), e), 23));
+		/* Rounding the largest channel up to 2^9 needs the next exponent */
+		__m256 top = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(m, scale), half));
+		__m256 carry = _mm256_cmp_ps(top, _mm256_set1_ps(512.0f), _CMP_EQ_OQ);
+		e = _mm256_sub_epi32(e, _mm256_castps_si256(carry));
+		scale = _mm256_blendv_ps(scale, _mm256_mul_ps(scale, half), carry);
+
+		__m256i cx = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(x, scale), half));
+		__m256i cy = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(y, scale), half));
+		__m256i cz = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(z, scale), half));
+		__m256i packed = _mm256_or_si256(_mm256_or_si256(cx, _mm256_slli_epi32(cy, 9)),
+			_mm256_or_si256(_mm256_slli_epi32(cz, 18), _mm256_slli_epi32(e, 27)));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_permutevar8x32_epi32(packed, order));
+	}
+	packRgb9e5Scalar(src + i, dst + i, n - i);
+}
+
+#endif
+
+void packDisplay(const vec4* src, void* dst, int n, int format)
+{
+	switch (format)
+	{
+	case DISPLAY_RGBA16F:
+#ifdef DISPLAY_F16C
+		packHalfAVX2(src, (uint64_t*)dst, n);
+#else
+		packHalfScalar(src, (uint64_t*)dst, n);
+#endif
+		break;
+	case DISPLAY_RGB9E5:
+#ifdef __AVX2__
+		packRgb9e5AVX2(src, (uint32_t*)dst, n);
+#else
+		packRgb9e5Scalar(src, (uint32_t*)dst, n);
+#endif
+		break;
+	default:
+		memcpy(dst, src, size_t(n)*sizeof(vec4));
+	}
+}
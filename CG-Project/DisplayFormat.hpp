@@ -0,0 +1,45 @@
+#pragma once
+
+/**
+ * @file DisplayFormat.hpp
+ * @author
+ * @brief Contains the packed pixel formats the display copy of the film can be kept in
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "MltPixel.hpp"
+
+/* Pixel formats of the display copy, RGBA32F is 16 bytes per pixel */
+#define DISPLAY_RGBA32F 0
+/* Half floats, 8 bytes per pixel */
+#define DISPLAY_RGBA16F 1
+/* Three 9 bit mantissas with a shared 5 bit exponent, 4 bytes per pixel, no alpha */
+#define DISPLAY_RGB9E5 2
+
+/**
+ * @brief Returns the display format with the given name, rgba32f, rgba16f or rgb9e5,
+ * or -1 if there is none
+ *
+ */
+int parseDisplayFormat(const char* name);
+
+/**
+ * @brief Returns the bytes per pixel of a display format
+ *
+ */
+int displayPixelSize(int format);
+
+/**
+ * @brief Converts pixels into a display format, with the encodings of glm's packHalf4x16
+ * and packF3x9_E1x5. The AVX2 build converts several pixels per instruction.
+ *
+ * @param src Pixels to convert
+ * @param dst Destination of n*displayPixelSize(format) bytes
+ * @param n Number of pixels
+ * @param format Display format
+ */
+void packDisplay(const vec4* src, void* dst, int n, int format);
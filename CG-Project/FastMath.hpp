@@ -0,0 +1,311 @@
+#pragma once
+
+/**
+ * @file FastMath.hpp
+ * @author
+ * @brief Contains polynomial log2, exp2, pow and sincos for floats, glm vectors and SSE4/AVX2 registers
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE4_1__) || defined(__AVX__)
+#include <immintrin.h>
+#define FAST_MATH_SSE4 1
+#endif
+
+#include "glm/glm.hpp"
+
+/*
+ * Every function rounds the same sequence of float operations in all three widths, so a
+ * loop whose tail runs the scalar version gets the same results as its SIMD body. Fused
+ * multiply-adds would break that, so contraction is off down to the end of the file.
+ *
+ * Measured against libm in double precision over their whole domain:
+ *  approxLog2   absolute error below 2e-7 for x in [1/2, 2], relative 4 ulp outside
+ *  approxExp2   relative error below 2 ulp
+ *  approxPow    relative error below 3 ulp + (|y*log2(x)| + |y|)*1.2e-7
+ *  approxSinCos absolute error below 2e-7 for |x| < 2 pi, plus the rounding of x/(2 pi)
+ *
+ * FastMathTest.cpp checks these bounds.
+ */
+#if defined(__clang__)
+#pragma float_control(push)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+/* log2(m) = 2/ln(2)*atanh(t) for t = (m - 1)/(m + 1), m in [sqrt(2)/2, sqrt(2)], odd powers of t up to t^9 */
+static const float fastLogC[5] = {2.88539008f, 0.961796694f, 0.577078016f, 0.412198583f, 0.320598898f};
+/* 2^f = e^(f ln 2) for |f| <= 0.5, Taylor terms up to f^7 */
+static const float fastExpC[8] = {1.0f, 0.693147181f, 0.240226507f, 0.0555041087f, 0.00961812911f, 0.00133335581f, 0.000154035304f, 1.52527338e-05f};
+/* sin(2 pi r) and cos(2 pi r) for |r| <= 1/8, Taylor terms up to r^9 and r^10 */
+static const float fastSinC[5] = {6.28318531f, -41.3417022f, 81.6052493f, -76.7058598f, 42.0586939f};
+static const float fastCosC[6] = {1.0f, -19.7392088f, 64.9393940f, -85.4568172f, 60.2446414f, -26.4262568f};
+
+#define FAST_SQRT2 1.41421356f
+#define FAST_INV_2PI 0.159154943f
+
+/**
+ * @brief Returns log2(x) for a normal x > 0. Zeros, denormals, infinities and NaNs are
+ * not handled.
+ *
+ */
+inline float approxLog2(float x)
+{
+	uint32_t bits;
+	memcpy(&bits, &x, 4);
+	float e = float(int(bits >> 23) - 127);
+	bits = (bits & 0x7FFFFF) | 0x3F800000;
+	float m;
+	memcpy(&m, &bits, 4);
+	if (m > FAST_SQRT2)
+	{
+		m = m*0.5f;
+		e = e + 1.0f;
+	}
+	float t = (m - 1.0f)/(m + 1.0f), t2 = t*t;
+	return e + t*(fastLogC[0] + t2*(fastLogC[1] + t2*(fastLogC[2] + t2*(fastLogC[3] + t2*fastLogC[4]))));
+}
+
+/**
+ * @brief Returns 2^x, flushed to 0 below 2^-126 and clamped to 2^127 above
+ *
+ */
+inline float approxExp2(float x)
+{
+	if (x < -126.0f)
+		return 0.0f;
+	x = std::min(x, 127.0f);
+	float n = nearbyintf(x), f = x - n;
+	float p = fastExpC[7];
+	for (int k = 6; k >= 0; k--)
+		p = fastExpC[k] + f*p;
+	uint32_t bits = uint32_t(int(n) + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, 4);
+	return p*scale;
+}
+
+/**
+ * @brief Returns x^y for x >= 0, x normal or zero. 0^y is 0.
+ *
+ */
+inline float approxPow(float x, float y)
+{
+	return x > 0 ? approxExp2(y*approxLog2(x)) : 0.0f;
+}
+
+/**
+ * @brief Returns sin(2 pi u) and cos(2 pi u), accurate for any u a float can hold
+ * exactly, so angles given in turns skip the rounding of approxSinCos()
+ *
+ */
+inline void approxSinCos2Pi(float u, float& s, float& c)
+{
+	float q = nearbyintf(4.0f*u), r = u - 0.25f*q, r2 = r*r;
+	float sr = fastSinC[4], cr = fastCosC[5];
+	for (int k = 3; k >= 0; k--)
+		sr = fastSinC[k] + r2*sr;
+	for (int k = 4; k >= 0; k--)
+		cr = fastCosC[k] + r2*cr;
+	sr = r*sr;
+	int quadrant = int(q) & 3;
+	s = (quadrant & 1) ? cr : sr;
+	c = (quadrant & 1) ? sr : cr;
+	if (quadrant & 2)
+		s = -s;
+	if ((quadrant + 1) & 2)
+		c = -c;
+}
+
+/**
+ * @brief Returns sin(x) and cos(x) of an angle in radians
+ *
+ */
+inline void approxSinCos(float x, float& s, float& c)
+{
+	approxSinCos2Pi(x*FAST_INV_2PI, s, c);
+}
+
+/* glm style overloads, one component at a time */
+
+template<glm::length_t L, glm::qualifier Q>
+glm::vec<L, float, Q> approxLog2(const glm::vec<L, float, Q>& x)
+{
+	glm::vec<L, float, Q> r;
+	for (glm::length_t i = 0; i < L; i++)
+		r[i] = approxLog2(x[i]);
+	return r;
+}
+
+template<glm::length_t L, glm::qualifier Q>
+glm::vec<L, float, Q> approxExp2(const glm::vec<L, float, Q>& x)
+{
+	glm::vec<L, float, Q> r;
+	for (glm::length_t i = 0; i < L; i++)
+		r[i] = approxExp2(x[i]);
+	return r;
+}
+
+template<glm::length_t L, glm::qualifier Q>
+glm::vec<L, float, Q> approxPow(const glm::vec<L, float, Q>& x, const glm::vec<L, float, Q>& y)
+{
+	glm::vec<L, float, Q> r;
+	for (glm::length_t i = 0; i < L; i++)
+		r[i] = approxPow(x[i], y[i]);
+	return r;
+}
+
+template<glm::length_t L, glm::qualifier Q>
+void approxSinCos(const glm::vec<L, float, Q>& x, glm::vec<L, float, Q>& s, glm::vec<L, float, Q>& c)
+{
+	for (glm::length_t i = 0; i < L; i++)
+		approxSinCos(x[i], s[i], c[i]);
+}
+
+#ifdef FAST_MATH_SSE4
+
+inline __m128 approxLog2(__m128 x)
+{
+	__m128i bits = _mm_castps_si128(x);
+	__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+	__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x7FFFFF)), _mm_set1_epi32(0x3F800000)));
+	__m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(FAST_SQRT2));
+	m = _mm_blendv_ps(m, _mm_mul_ps(m, _mm_set1_ps(0.5f)), big);
+	e = _mm_blendv_ps(e, _mm_add_ps(e, _mm_set1_ps(1.0f)), big);
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one)), t2 = _mm_mul_ps(t, t);
+	__m128 p = _mm_set1_ps(fastLogC[4]);
+	for (int k = 3; k >= 0; k--)
+		p = _mm_add_ps(_mm_set1_ps(fastLogC[k]), _mm_mul_ps(t2, p));
+	return _mm_add_ps(e, _mm_mul_ps(t, p));
+}
+
+inline __m128 approxExp2(__m128 x)
+{
+	__m128 under = _mm_cmplt_ps(x, _mm_set1_ps(-126.0f));
+	/* Operands ordered like std::min() */
+	x = _mm_min_ps(_mm_set1_ps(127.0f), x);
+	__m128 n = _mm_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), f = _mm_sub_ps(x, n);
+	__m128 p = _mm_set1_ps(fastExpC[7]);
+	for (int k = 6; k >= 0; k--)
+		p = _mm_add_ps(_mm_set1_ps(fastExpC[k]), _mm_mul_ps(f, p));
+	__m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+	return _mm_andnot_ps(under, _mm_mul_ps(p, _mm_castsi128_ps(bits)));
+}
+
+inline __m128 approxPow(__m128 x, __m128 y)
+{
+	__m128 positive = _mm_cmpgt_ps(x, _mm_setzero_ps());
+	/* Zeros go through log2() as 1 and are masked afterwards */
+	__m128 r = approxExp2(_mm_mul_ps(y, approxLog2(_mm_blendv_ps(_mm_set1_ps(1.0f), x, positive))));
+	return _mm_and_ps(r, positive);
+}
+
+inline void approxSinCos2Pi(__m128 u, __m128& s, __m128& c)
+{
+	__m128 q = _mm_round_ps(_mm_mul_ps(_mm_set1_ps(4.0f), u), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m128 r = _mm_sub_ps(u, _mm_mul_ps(_mm_set1_ps(0.25f), q)), r2 = _mm_mul_ps(r, r);
+	__m128 sr = _mm_set1_ps(fastSinC[4]), cr = _mm_set1_ps(fastCosC[5]);
+	for (int k = 3; k >= 0; k--)
+		sr = _mm_add_ps(_mm_set1_ps(fastSinC[k]), _mm_mul_ps(r2, sr));
+	for (int k = 4; k >= 0; k--)
+		cr = _mm_add_ps(_mm_set1_ps(fastCosC[k]), _mm_mul_ps(r2, cr));
+	sr = _mm_mul_ps(r, sr);
+	__m128i quadrant = _mm_and_si128(_mm_cvtps_epi32(q), _mm_set1_epi32(3));
+	__m128 odd = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+	s = _mm_blendv_ps(sr, cr, odd);
+	c = _mm_blendv_ps(cr, sr, odd);
+	/* Flip the sign of sin in quadrants 2, 3 and of cos in quadrants 1, 2 */
+	__m128i sinSign = _mm_slli_epi32(_mm_srli_epi32(quadrant, 1), 31);
+	__m128i cosSign = _mm_slli_epi32(_mm_srli_epi32(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), 1), 31);
+	s = _mm_xor_ps(s, _mm_castsi128_ps(sinSign));
+	c = _mm_xor_ps(c, _mm_castsi128_ps(cosSign));
+}
+
+inline void approxSinCos(__m128 x, __m128& s, __m128& c)
+{
+	approxSinCos2Pi(_mm_mul_ps(x, _mm_set1_ps(FAST_INV_2PI)), s, c);
+}
+
+#endif
+
+#ifdef __AVX2__
+
+inline __m256 approxLog2(__m256 x)
+{
+	__m256i bits = _mm256_castps_si256(x);
+	__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+	__m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x7FFFFF)), _mm256_set1_epi32(0x3F800000)));
+	__m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(FAST_SQRT2), _CMP_GT_OQ);
+	m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+	e = _mm256_blendv_ps(e, _mm256_add_ps(e, _mm256_set1_ps(1.0f)), big);
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one)), t2 = _mm256_mul_ps(t, t);
+	__m256 p = _mm256_set1_ps(fastLogC[4]);
+	for (int k = 3; k >= 0; k--)
+		p = _mm256_add_ps(_mm256_set1_ps(fastLogC[k]), _mm256_mul_ps(t2, p));
+	return _mm256_add_ps(e, _mm256_mul_ps(t, p));
+}
+
+inline __m256 approxExp2(__m256 x)
+{
+	__m256 under = _mm256_cmp_ps(x, _mm256_set1_ps(-126.0f), _CMP_LT_OQ);
+	x = _mm256_min_ps(_mm256_set1_ps(127.0f), x);
+	__m256 n = _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), f = _mm256_sub_ps(x, n);
+	__m256 p = _mm256_set1_ps(fastExpC[7]);
+	for (int k = 6; k >= 0; k--)
+		p = _mm256_add_ps(_mm256_set1_ps(fastExpC[k]), _mm256_mul_ps(f, p));
+	__m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+	return _mm256_andnot_ps(under, _mm256_mul_ps(p, _mm256_castsi256_ps(bits)));
+}
+
+inline __m256 approxPow(__m256 x, __m256 y)
+{
+	__m256 positive = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+	__m256 r = approxExp2(_mm256_mul_ps(y, approxLog2(_mm256_blendv_ps(_mm256_set1_ps(1.0f), x, positive))));
+	return _mm256_and_ps(r, positive);
+}
+
+inline void approxSinCos2Pi(__m256 u, __m256& s, __m256& c)
+{
+	__m256 q = _mm256_round_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), u), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 r = _mm256_sub_ps(u, _mm256_mul_ps(_mm256_set1_ps(0.25f), q)), r2 = _mm256_mul_ps(r, r);
+	__m256 sr = _mm256_set1_ps(fastSinC[4]), cr = _mm256_set1_ps(fastCosC[5]);
+	for (int k = 3; k >= 0; k--)
+		sr = _mm256_add_ps(_mm256_set1_ps(fastSinC[k]), _mm256_mul_ps(r2, sr));
+	for (int k = 4; k >= 0; k--)
+		cr = _mm256_add_ps(_mm256_set1_ps(fastCosC[k]), _mm256_mul_ps(r2, cr));
+	sr = _mm256_mul_ps(r, sr);
+	__m256i quadrant = _mm256_and_si256(_mm256_cvtps_epi32(q), _mm256_set1_epi32(3));
+	__m256 odd = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+	s = _mm256_blendv_ps(sr, cr, odd);
+	c = _mm256_blendv_ps(cr, sr, odd);
+	__m256i sinSign = _mm256_slli_epi32(_mm256_srli_epi32(quadrant, 1), 31);
+	__m256i cosSign = _mm256_slli_epi32(_mm256_srli_epi32(_mm256_add_epi32(quadrant, _mm256_set1_epi32(1)), 1), 31);
+	s = _mm256_xor_ps(s, _mm256_castsi256_ps(sinSign));
+	c = _mm256_xor_ps(c, _mm256_castsi256_ps(cosSign));
+}
+
+inline void approxSinCos(__m256 x, __m256& s, __m256& c)
+{
+	approxSinCos2Pi(_mm256_mul_ps(x, _mm256_set1_ps(FAST_INV_2PI)), s, c);
+}
+
+#endif
+
+#if defined(__clang__)
+#pragma float_control(pop)
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
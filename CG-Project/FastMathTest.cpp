@@ -0,0 +1,339 @@
+/**
+ * @file FastMathTest.cpp
+ * @author
+ * @brief Checks the polynomials of FastMath.hpp against libm in double precision, with the
+ * error bounds its header states, for floats, SSE4 and AVX2 registers. Returns 1 if any
+ * result is out of bounds or a register lane differs from the float version.
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <cfloat>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "FastMath.hpp"
+
+using namespace std;
+
+/* Random inputs per function, on top of the edge cases */
+#define TEST_RANDOM 1000000
+
+/**
+ * @brief Struct for the worst result of one function at one width, as a fraction of the bound
+ *
+ */
+struct ErrorStat
+{
+	const char* name;
+	double worst = 0;
+	float worstX = 0, worstY = 0;
+	long checked = 0, failed = 0, mismatched = 0;
+
+	ErrorStat(const char* name) : name(name) {}
+
+	void check(float x, float y, double err, double bound)
+	{
+		checked++;
+		double ratio = err/bound;
+		if (!(ratio <= 1))
+		{
+			if (failed++ < 5)
+				printf("  %s(%.9g, %.9g): error %.3g above bound %.3g\n", name, x, y, err, bound);
+		}
+		if (!(ratio <= worst))
+		{
+			worst = ratio;
+			worstX = x;
+			worstY = y;
+		}
+	}
+
+	/* Lanes of the registers have to round exactly like the float version */
+	void compare(float x, float y, float lane, float scalar)
+	{
+		if (memcmp(&lane, &scalar, 4) != 0 && mismatched++ < 5)
+			printf("  %s(%.9g, %.9g): lane %.9g, float version %.9g\n", name, x, y, lane, scalar);
+	}
+
+	bool report() const
+	{
+		printf("%-24s %8ld inputs, worst %.2f of the bound at (%.9g, %.9g)%s\n", name, checked, worst, worstX, worstY,
+			failed || mismatched ? "  FAILED" : "");
+		return !failed && !mismatched;
+	}
+};
+
+/**
+ * @brief Returns the spacing of the floats around r
+ *
+ */
+static double ulp(double r)
+{
+	float f = float(fabs(r));
+	return ldexp(1.0, max(ilogb(f), FLT_MIN_EXP - 1) - 23);
+}
+
+static float fromBits(uint32_t bits)
+{
+	float x;
+	memcpy(&x, &bits, 4);
+	return x;
+}
+
+/* Bounds of the FastMath.hpp header */
+
+static void checkLog2(ErrorStat& stat, float x, float r)
+{
+	double exact = log2(double(x));
+	stat.check(x, 0, fabs(r - exact), x < 0.5f || x > 2.0f ? 4*ulp(exact) : 2e-7);
+}
+
+static void checkExp2(ErrorStat& stat, float x, float r)
+{
+	if (x < -126.0f)
+	{
+		stat.check(x, 0, r, 1e-300);
+		return;
+	}
+	double exact = exp2(double(min(x, 127.0f)));
+	stat.check(x, 0, fabs(r - exact), 2*ulp(exact));
+}
+
+static void checkPow(ErrorStat& stat, float x, float y, float r)
+{
+	if (x == 0)
+	{
+		stat.check(x, y, r, 1e-300);
+		return;
+	}
+	double exact = pow(double(x), double(y));
+	stat.check(x, y, fabs(r - exact), 3*ulp(exact) + exact*(fabs(y*log2(double(x))) + fabs(y))*1.2e-7);
+}
+
+/* Turns are reduced exactly in double, sin(2 pi u) of a large u would lose the fraction */
+static void checkSinCos2Pi(ErrorStat& stat, float u, float s, float c)
+{
+	double r = double(u) - nearbyint(double(u));
+	stat.check(u, 0, fabs(s - sin(2*M_PI*r)), 2e-7);
+	stat.check(u, 1, fabs(c - cos(2*M_PI*r)), 2e-7);
+}
+
+/* Radians pay for the rounding of x/(2 pi) on top */
+static void checkSinCos(ErrorStat& stat, float x, float s, float c)
+{
+	float u = x*FAST_INV_2PI;
+	double rounding = fabs(2*M_PI*double(u) - double(x));
+	stat.check(x, 0, fabs(s - sin(double(x))), 2e-7 + rounding);
+	stat.check(x, 1, fabs(c - cos(double(x))), 2e-7 + rounding);
+}
+
+/**
+ * @brief Struct for the inputs of every function, edge cases first
+ *
+ */
+struct Inputs
+{
+	vector<float> log2, exp2, powX, powY, turns, radians;
+
+	Inputs()
+	{
+		mt19937 rng(1);
+		uniform_real_distribution<float> uniform(0, 1);
+
+		/* Powers of two, the boundary of the mantissa range at sqrt(2) and their neighbours */
+		for (int e = -126; e <= 127; e++)
+			for (float x : {ldexpf(1, e), ldexpf(FAST_SQRT2, e)})
+				for (float y : {nextafterf(x, 0), x, nextafterf(x, FLT_MAX)})
+					if (y >= FLT_MIN && y <= FLT_MAX)
+						log2.push_back(y);
+		log2.push_back(FLT_MAX);
+		for (int i = 0; i < TEST_RANDOM; i++)
+			log2.push_back(fromBits(0x00800000u + rng()%(0x7F800000u - 0x00800000u)));
+
+		/* Integers and half integers, where the reduction rounds the other way, and the clamps */
+		for (float x = -130; x <= 130; x += 0.5f)
+			for (float y : {nextafterf(x, -FLT_MAX), x, nextafterf(x, FLT_MAX)})
+				exp2.push_back(y);
+		for (float x : {0.0f, -0.0f, 1e-30f, -1e-30f, -1000.0f, 1000.0f})
+			exp2.push_back(x);
+		for (int i = 0; i < TEST_RANDOM; i++)
+			exp2.push_back(-126 + 253*uniform(rng));
+
+		/* Zero, one and exponents of zero, then results spread over the normal range */
+		for (float x : {0.0f, 1.0f, 0.5f, 2.0f, FLT_MIN, 1e-20f, 1e20f})
+			for (float y : {0.0f, 1.0f, -1.0f, 0.5f, 2.0f, 1e-5f, 3.0f})
+				if (x == 0 || fabs(y*log2f(x)) < 125)
+				{
+					powX.push_back(x);
+					powY.push_back(y);
+				}
+		for (int i = 0; i < TEST_RANDOM; i++)
+		{
+			float x = exp2f(-60 + 120*uniform(rng)), l = log2f(x);
+			/* |y*log2(x)| up to 120, or y up to 100 for x close to 1 */
+			float yMax = min(100.0f, 120/max(fabs(l), 1e-6f));
+			powX.push_back(x);
+			powY.push_back(yMax*(2*uniform(rng) - 1));
+		}
+
+		/* Quadrant boundaries in turns, where the reduction switches polynomials */
+		for (int q = -16; q <= 16; q++)
+		{
+			float x = 0.125f*q;
+			for (float y : {nextafterf(x, -FLT_MAX), x, nextafterf(x, FLT_MAX)})
+				turns.push_back(y);
+		}
+		for (float x : {1e-30f, -1e-30f, 1e6f + 0.3f, -1e6f - 0.7f, 8388607.5f})
+			turns.push_back(x);
+		for (int i = 0; i < TEST_RANDOM; i++)
+			turns.push_back(i%4 ? 2*uniform(rng) - 1 : 2e6f*(uniform(rng) - 0.5f));
+
+		/* Multiples of pi/4 and the edges of |x| < 2 pi */
+		for (int q = -8; q <= 8; q++)
+		{
+			float x = float(q*M_PI/4);
+			for (float y : {nextafterf(x, -FLT_MAX), x, nextafterf(x, FLT_MAX)})
+				if (fabs(y) < 2*M_PI)
+					radians.push_back(y);
+		}
+		radians.push_back(0.0f);
+		radians.push_back(1e-30f);
+		for (int i = 0; i < TEST_RANDOM; i++)
+			radians.push_back(float(2*M_PI)*(2*uniform(rng) - 1));
+	}
+};
+
+static bool testScalar(const Inputs& in)
+{
+	ErrorStat log2Stat("approxLog2(float)"), exp2Stat("approxExp2(float)"), powStat("approxPow(float)");
+	ErrorStat turnStat("approxSinCos2Pi(float)"), sinCosStat("approxSinCos(float)");
+	for (float x : in.log2)
+		checkLog2(log2Stat, x, approxLog2(x));
+	for (float x : in.exp2)
+		checkExp2(exp2Stat, x, approxExp2(x));
+	for (size_t i = 0; i < in.powX.size(); i++)
+		checkPow(powStat, in.powX[i], in.powY[i], approxPow(in.powX[i], in.powY[i]));
+	for (float u : in.turns)
+	{
+		float s, c;
+		approxSinCos2Pi(u, s, c);
+		checkSinCos2Pi(turnStat, u, s, c);
+	}
+	for (float x : in.radians)
+	{
+		float s, c;
+		approxSinCos(x, s, c);
+		checkSinCos(sinCosStat, x, s, c);
+	}
+	bool ok = log2Stat.report();
+	ok &= exp2Stat.report();
+	ok &= powStat.report();
+	ok &= turnStat.report();
+	return sinCosStat.report() && ok;
+}
+
+/*
+ * The register versions run over the same inputs W at a time. Loads, stores and the float
+ * version are passed in, so that both widths share the loops below.
+ */
+template<int W, typename Reg, typename Load, typename Store>
+static bool testRegister(const Inputs& in, const char* suffix, Load load, Store store)
+{
+	string names[5] = {"approxLog2", "approxExp2", "approxPow", "approxSinCos2Pi", "approxSinCos"};
+	for (string& name : names)
+		name += suffix;
+	ErrorStat log2Stat(names[0].c_str()), exp2Stat(names[1].c_str()), powStat(names[2].c_str());
+	ErrorStat turnStat(names[3].c_str()), sinCosStat(names[4].c_str());
+	float r[W], s[W], c[W];
+
+	for (size_t i = 0; i + W <= in.log2.size(); i += W)
+	{
+		store(r, approxLog2(load(&in.log2[i])));
+		for (int k = 0; k < W; k++)
+		{
+			checkLog2(log2Stat, in.log2[i + k], r[k]);
+			log2Stat.compare(in.log2[i + k], 0, r[k], approxLog2(in.log2[i + k]));
+		}
+	}
+	for (size_t i = 0; i + W <= in.exp2.size(); i += W)
+	{
+		store(r, approxExp2(load(&in.exp2[i])));
+		for (int k = 0; k < W; k++)
+		{
+			checkExp2(exp2Stat, in.exp2[i + k], r[k]);
+			exp2Stat.compare(in.exp2[i + k], 0, r[k], approxExp2(in.exp2[i + k]));
+		}
+	}
+	for (size_t i = 0; i + W <= in.powX.size(); i += W)
+	{
+		store(r, approxPow(load(&in.powX[i]), load(&in.powY[i])));
+		for (int k = 0; k < W; k++)
+		{
+			checkPow(powStat, in.powX[i + k], in.powY[i + k], r[k]);
+			powStat.compare(in.powX[i + k], in.powY[i + k], r[k], approxPow(in.powX[i + k], in.powY[i + k]));
+		}
+	}
+	for (size_t i = 0; i + W <= in.turns.size(); i += W)
+	{
+		Reg sr, cr;
+		approxSinCos2Pi(load(&in.turns[i]), sr, cr);
+		store(s, sr);
+		store(c, cr);
+		for (int k = 0; k < W; k++)
+		{
+			float ss, cs;
+			approxSinCos2Pi(in.turns[i + k], ss, cs);
+			checkSinCos2Pi(turnStat, in.turns[i + k], s[k], c[k]);
+			turnStat.compare(in.turns[i + k], 0, s[k], ss);
+			turnStat.compare(in.turns[i + k], 1, c[k], cs);
+		}
+	}
+	for (size_t i = 0; i + W <= in.radians.size(); i += W)
+	{
+		Reg sr, cr;
+		approxSinCos(load(&in.radians[i]), sr, cr);
+		store(s, sr);
+		store(c, cr);
+		for (int k = 0; k < W; k++)
+		{
+			float ss, cs;
+			approxSinCos(in.radians[i + k], ss, cs);
+			checkSinCos(sinCosStat, in.radians[i + k], s[k], c[k]);
+			sinCosStat.compare(in.radians[i + k], 0, s[k], ss);
+			sinCosStat.compare(in.radians[i + k], 1, c[k], cs);
+		}
+	}
+	bool ok = log2Stat.report();
+	ok &= exp2Stat.report();
+	ok &= powStat.report();
+	ok &= turnStat.report();
+	return sinCosStat.report() && ok;
+}
+
+int main()
+{
+	Inputs in;
+	bool ok = testScalar(in);
+#ifdef FAST_MATH_SSE4
+	ok &= testRegister<4, __m128>(in, "(__m128)",
+		[](const float* p) { return _mm_loadu_ps(p); },
+		[](float* p, __m128 v) { _mm_storeu_ps(p, v); });
+#else
+	printf("__m128 versions not built, compile with -msse4.1\n");
+#endif
+#ifdef __AVX2__
+	ok &= testRegister<8, __m256>(in, "(__m256)",
+		[](const float* p) { return _mm256_loadu_ps(p); },
+		[](float* p, __m256 v) { _mm256_storeu_ps(p, v); });
+#else
+	printf("__m256 versions not built, compile with -mavx2\n");
+#endif
+	printf(ok ? "All within bounds\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,265 @@
+/**
+ * @file Headless.cpp
+ * @author
+ * @brief Contains the offline render loop used on machines without a display
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "AccumFilm.hpp"
+#include "AdaptiveSampler.hpp"
+#include "BatchMath.hpp"
+#include "Bdpt.hpp"
+#include "Headless.hpp"
+#include "ImageIO.hpp"
+#include "MltPixel.hpp"
+#include "PerfCounters.hpp"
+#include "Pssmlt.hpp"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+#include "Wavefront.hpp"
+
+using namespace std;
+
+bool hasFlag(int argc, char** argv, const char* flag)
+{
+	for (int i = 1; i < argc; i++)
+		if (strcmp(argv[i], flag) == 0)
+			return true;
+	return false;
+}
+
+const char* flagValue(int argc, char** argv, const char* flag, const char* def)
+{
+	for (int i = 1; i + 1 < argc; i++)
+		if (strcmp(argv[i], flag) == 0)
+			return argv[i + 1];
+	return def;
+}
+
+int renderHeadless(int argc, char** argv)
+{
+	int imgWidth = atoi(flagValue(argc, argv, "--width", "900"));
+	int imgHeight = atoi(flagValue(argc, argv, "--height", "900"));
+	int frames = atoi(flagValue(argc, argv, "--frames", "16"));
+	double timeLimit = atof(flagValue(argc, argv, "--time", "0"));
+	unsigned threads = (unsigned)atoi(flagValue(argc, argv, "--threads", "0"));
+	string out = flagValue(argc, argv, "--out", "render");
+	string scenePath = flagValue(argc, argv, "--scene", "scene.txt");
+	float exposure = (float)atof(flagValue(argc, argv, "--exposure", "1"));
+	float gamma = (float)atof(flagValue(argc, argv, "--gamma", "1"));
+	bool packets = !hasFlag(argc, argv, "--no-packets");
+	bool pssmlt = hasFlag(argc, argv, "--pssmlt");
+	bool bdpt = hasFlag(argc, argv, "--bdpt");
+	bool wavefront = hasFlag(argc, argv, "--wavefront");
+	int binBatch = atoi(flagValue(argc, argv, "--bin-batch", "0"));
+	bool batchShade = hasFlag(argc, argv, "--batch-shade");
+	int simdLevel = parseSimdLevel(flagValue(argc, argv, "--simd", simdLevelName(DetectSimdLevel())));
+	int chains = atoi(flagValue(argc, argv, "--chains", "64"));
+	int bootstrap = atoi(flagValue(argc, argv, "--bootstrap", "100000"));
+	float mpp = (float)atof(flagValue(argc, argv, "--mpp", "1"));
+	float adaptive = (float)atof(flagValue(argc, argv, "--adaptive", "0"));
+	int tileSize = atoi(flagValue(argc, argv, "--tile-size", to_string(TILE_SIZE).c_str()));
+	int tileOrder = parseTileOrder(flagValue(argc, argv, "--tile-order", "hilbert"));
+	RenderConfig cfg;
+	cfg.maxHits = atoi(flagValue(argc, argv, "--max-hits", to_string(cfg.maxHits).c_str()));
+	cfg.minHits = atoi(flagValue(argc, argv, "--min-hits", to_string(cfg.minHits).c_str()));
+	cfg.samples = atoi(flagValue(argc, argv, "--samples", to_string(cfg.samples).c_str()));
+	cfg.mutations = atoi(flagValue(argc, argv, "--mutations", to_string(cfg.mutations).c_str()));
+	if (!setConfig(cfg))
+		return -1;
+	if (imgWidth <= 0 || imgHeight <= 0 || frames <= 0 || gamma <= 0)
+	{
+		cout << "Invalid resolution, frame count or gamma\n";
+		return -1;
+	}
+	if (pssmlt && (chains <= 0 || bootstrap <= 0 || mpp <= 0))
+	{
+		cout << "Invalid chain count, bootstrap count or mutations per pixel\n";
+		return -1;
+	}
+	if (tileSize <= 0 || tileOrder < 0)
+	{
+		cout << "ERROR: The tile size must be positive and the tile order scanline, morton or hilbert\n";
+		return -1;
+	}
+	if (binBatch < 0 || (binBatch > 0 && !wavefront))
+	{
+		cout << "ERROR: Binning needs a positive batch size and the wavefront\n";
+		return -1;
+	}
+	if (batchShade && !wavefront)
+	{
+		cout << "ERROR: Batched shading needs the wavefront\n";
+		return -1;
+	}
+	if (simdLevel < 0)
+	{
+		cout << "ERROR: The SIMD level must be scalar, sse2, avx2 or avx512\n";
+		return -1;
+	}
+	if (wavefront && (pssmlt || bdpt || cfg.mutations > 0))
+	{
+		cout << "ERROR: The wavefront renders independent paths, it needs --mutations 0 and neither PSSMLT nor BDPT\n";
+		return -1;
+	}
+	if (adaptive < 0 || (adaptive > 0 && (pssmlt || bdpt)))
+	{
+		cout << "ERROR: Adaptive sampling needs a positive error and the per-pixel chains, PSSMLT and BDPT splat anywhere\n";
+		return -1;
+	}
+
+	Scene scene;
+	if (!scene.load(scenePath))
+		return -1;
+	setScene(&scene);
+
+	int numPix = imgWidth*imgHeight;
+	AccumFilm film;
+	film.reset(imgWidth, imgHeight, tileSize);
+	/* The counters only follow threads started after them */
+	PerfCounters counters;
+	bool counting = counters.open();
+	ThreadPool pool(threads);
+	pool.setTileOrder(tileOrder);
+	cout << "Headless render " << imgWidth << "x" << imgHeight << " on " << pool.size() << " threads, "
+		<< tileSize << " pixel tiles in " << flagValue(argc, argv, "--tile-order", "hilbert") << " order\n";
+
+	auto start = chrono::steady_clock::now();
+	Pssmlt mlt;
+	int mutationsPerChain = max(1, int(mpp*numPix/chains));
+	if (pssmlt)
+	{
+		if (!mlt.init(pool, imgWidth, imgHeight, chains, bootstrap))
+		{
+			return -1;
+		}
+		cout << "PSSMLT: " << chains << " chains of " << mutationsPerChain << " mutations per frame, b = " << mlt.b << "\n";
+	}
+	Bdpt bidir;
+	if (bdpt)
+	{
+		if (scene.numEmitters() == 0)
+		{
+			cout << "ERROR: BDPT needs at least one emissive sphere\n";
+			return -1;
+		}
+		bidir.init(scene, imgWidth, imgHeight);
+	}
+	SetBatchSimdLevel(simdLevel);
+	Wavefront wave;
+	wave.setBinning(binBatch);
+	wave.setBatchShading(batchShade);
+	AdaptiveSampler sampler;
+	sampler.reset(imgWidth, imgHeight, tileSize, adaptive);
+	double elapsed = 0;
+	int iter = 0;
+	long long pixFrames = 0;
+	counters.start();
+	while (iter < frames && (timeLimit <= 0 || elapsed < timeLimit))
+	{
+		/* Without adaptive sampling every tile stays active */
+		vector<Tile> tiles = sampler.activeTiles();
+		for (const Tile& tile : tiles)
+			pixFrames += (tile.x1 - tile.x0)*(tile.y1 - tile.y0);
+		FrameHandle frame = pssmlt ? mlt.iterate(pool, mutationsPerChain, iter) : bdpt ? bidir.iterate(pool, iter) : pool.renderTiles(tiles,
+			[&](const Tile& tile, atomic<int>& done)
+			{
+				if (wavefront)
+				{
+					wave.renderTile(tile, imgWidth, imgHeight, film, done, iter, packets);
+					return;
+				}
+				for (int y = tile.y0; y < tile.y1; y++)
+					drawPixels(tile.x0, tile.x1, y, imgWidth, imgHeight, film, done, iter, packets);
+			});
+		frame.wait();
+		iter++;
+		elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << "Rendered frame " << iter << " (" << elapsed << " s)";
+		if (adaptive > 0)
+		{
+			int numActive = sampler.update(film);
+			cout << ", " << numActive << " of " << sampler.tiles.size() << " tiles above the error threshold";
+			if (numActive == 0)
+			{
+				cout << "\n";
+				break;
+			}
+		}
+		cout << "\n";
+	}
+
+	counters.stop();
+
+	vector<vec3> img(numPix);
+	if (pssmlt)
+		mlt.resolve(img.data());
+	else if (bdpt)
+		bidir.resolve(img.data());
+	else
+		film.resolve(img.data());
+
+	if (pssmlt)
+		cout << "Frames: " << iter << ", time: " << elapsed << " s, " << iter/elapsed << " frames/s, "
+			<< mlt.mutations/elapsed/1e6 << " M mutations/s\n";
+	else if (bdpt)
+		cout << "Frames: " << iter << ", time: " << elapsed << " s, " << iter/elapsed << " frames/s, "
+			<< double(numPix)*iter/elapsed/1e6 << " M path pairs/s\n";
+	else
+	{
+		double pixSamples = double(pixFrames)*cfg.samples;
+		cout << "Frames: " << iter << ", time: " << elapsed << " s, " << iter/elapsed << " frames/s, "
+			<< pixSamples/elapsed/1e6 << " M paths/s (" << cfg.mutations << " mutations each)\n";
+	}
+	if (wavefront)
+	{
+		cout << "Wavefront stages (thread seconds, batch kernels on " << simdLevelName(BatchSimdLevel()) << "):";
+		for (int i = 0; i < WAVE_STAGES; i++)
+			cout << " " << Wavefront::stageName(i) << " " << wave.stageTime(i);
+		cout << "\n";
+		cout << "Secondary rays: " << wave.secondaryRays()/1e6 << " M, hitting the same primitive as the ray traced before them: "
+			<< 100*wave.hitCoherence(false) << "% in queue order, " << 100*wave.hitCoherence(true) << "% as traced";
+		if (binBatch > 0)
+			cout << " (binned " << binBatch << " at a time)";
+		cout << "\n";
+	}
+	if (counting)
+	{
+		long long refs = counters.count(PERF_CACHE_REFS), misses = counters.count(PERF_CACHE_MISSES);
+		long long l1dMisses = counters.count(PERF_L1D_MISSES);
+		cout << "Cache:";
+		if (refs > 0 && misses >= 0)
+			cout << " " << misses/1e6 << " M of " << refs/1e6 << " M last level references missed (" << 100.0*misses/refs << "%), "
+				<< misses/double(max(1ll, pixFrames)) << " per pixel and frame,";
+		if (l1dMisses >= 0)
+			cout << " " << l1dMisses/1e6 << " M L1D load misses";
+		cout << "\n";
+	}
+	else
+		cout << "Cache: no hardware counters available\n";
+
+	if (!writePfm(out + ".pfm", img.data(), imgWidth, imgHeight))
+	{
+		cout << "ERROR: Could not write " << out << ".pfm\n";
+		return -1;
+	}
+	if (!writePpm(out + ".ppm", img.data(), imgWidth, imgHeight, exposure, gamma))
+	{
+		cout << "ERROR: Could not write " << out << ".ppm\n";
+		return -1;
+	}
+	cout << "Wrote " << out << ".pfm and " << out << ".ppm\n";
+	return 0;
+}
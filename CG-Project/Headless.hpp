@@ -0,0 +1,58 @@
+#pragma once
+
+/**
+ * @file Headless.hpp
+ * @author
+ * @brief Contains the offline render entry point which runs without an OpenGL context
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+/**
+ * @brief Renders frames without a window and writes the averaged image to disk.
+ *
+ * Flags:
+ *  --width W, --height H     Image resolution (900x900)
+ *  --frames N                Number of frames to average (16)
+ *  --time S                  Stop after S seconds even if frames remain (0 = no limit)
+ *  --threads T               Render threads (0 = hardware concurrency)
+ *  --scene PATH              Scene description file (scene.txt)
+ *  --out PATH                Output prefix, writes PATH.pfm and PATH.ppm (render)
+ *  --exposure E, --gamma G   Tone mapping of the 8 bit image (1, 1)
+ *  --max-hits N              Longest path in bounces, up to MAX_HITS (10)
+ *  --min-hits N              Bounces before Russian roulette may end a path (3)
+ *  --samples N               Paths per pixel before the mutations start (1)
+ *  --mutations N             Mutations of the per-pixel Markov chains (100)
+ *  --adaptive E              Render only tiles whose mean relative error is above E, until none is left (0 = off)
+ *  --tile-size N             Side of the square tiles the threads render (TILE_SIZE)
+ *  --tile-order O            Order tiles are dealt to the threads in, scanline, morton or hilbert (hilbert)
+ *  --no-packets              Trace camera rays one at a time instead of in packets
+ *  --wavefront               Render the independent paths stage by stage over queues of whole tiles, needs --mutations 0
+ *  --bin-batch N             Sort the wavefront's secondary rays N at a time by origin cell and direction octant (0 = off)
+ *  --batch-shade             Sample the wavefront's scattered directions all at once, grouped by material
+ *  --bdpt                    Render with the bidirectional path tracer instead of MLT
+ *  --pssmlt                  Render with global PSSMLT chains instead of per-pixel chains
+ *  --chains N                PSSMLT Markov chains, run in parallel (64)
+ *  --bootstrap N             Independent paths estimating the PSSMLT normalization (100000)
+ *  --mpp M                   PSSMLT mutations per pixel and frame (1)
+ *
+ * @param argc Argument count of main
+ * @param argv Argument vector of main
+ * @return int Exit code of the application
+ */
+int renderHeadless(int argc, char** argv);
+
+/**
+ * @brief Returns true if the given flag is present on the command line.
+ *
+ */
+bool hasFlag(int argc, char** argv, const char* flag);
+
+/**
+ * @brief Returns the value following the given flag, or def if the flag is absent
+ *
+ */
+const char* flagValue(int argc, char** argv, const char* flag, const char* def);
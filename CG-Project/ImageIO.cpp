@@ -0,0 +1,80 @@
+/**
+ * @file ImageIO.cpp
+ * @author
+ * @brief Contains the implementation of the PFM and PPM image writers
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "ImageIO.hpp"
+
+using namespace std;
+
+/**
+ * @brief Returns true if the machine stores floats little endian
+ *
+ */
+static bool littleEndian()
+{
+	uint32_t one = 1;
+	unsigned char b;
+	memcpy(&b, &one, 1);
+	return b == 1;
+}
+
+bool writePfm(const string& path, const vec3* pixels, int imgWidth, int imgHeight)
+{
+	ofstream f(path, ios::binary);
+	if (!f)
+		return false;
+	/* A negative scale marks the data as little endian */
+	f << "PF\n" << imgWidth << " " << imgHeight << "\n" << (littleEndian() ? "-1.0" : "1.0") << "\n";
+	vector<float> row(3*imgWidth);
+	for (int y = 0; y < imgHeight; y++)
+	{
+		for (int x = 0; x < imgWidth; x++)
+		{
+			const vec3& c = pixels[y*imgWidth + x];
+			row[3*x] = c.r;
+			row[3*x + 1] = c.g;
+			row[3*x + 2] = c.b;
+		}
+		f.write((const char*)row.data(), row.size()*sizeof(float));
+	}
+	return bool(f);
+}
+
+bool writePpm(const string& path, const vec3* pixels, int imgWidth, int imgHeight, float exposure, float gamma)
+{
+	ofstream f(path, ios::binary);
+	if (!f)
+		return false;
+	f << "P6\n" << imgWidth << " " << imgHeight << "\n255\n";
+	vector<unsigned char> row(3*imgWidth);
+	float invGamma = 1.0f/gamma;
+	/* PPM stores the top row first */
+	for (int y = imgHeight - 1; y >= 0; y--)
+	{
+		for (int x = 0; x < imgWidth; x++)
+		{
+			vec3 c = pixels[y*imgWidth + x]*exposure;
+			for (int i = 0; i < 3; i++)
+				c[i] = std::isfinite(c[i]) ? glm::clamp(c[i], 0.0f, 1.0f) : 0.0f;
+			if (gamma != 1.0f)
+				c = glm::pow(c, vec3(invGamma));
+			for (int i = 0; i < 3; i++)
+				row[3*x + i] = (unsigned char)(c[i]*255.0f + 0.5f);
+		}
+		f.write((const char*)row.data(), row.size());
+	}
+	return bool(f);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+/**
+ * @file ImageIO.hpp
+ * @author
+ * @brief Contains the image writers used by the headless renderer
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <string>
+
+#include "MltPixel.hpp"
+
+/**
+ * @brief Writes the float image as a little endian colour PFM file.
+ * Row 0 of the image is the bottom row, which is also the PFM row order.
+ *
+ * @param path Path of the output file
+ * @param pixels Pointer to imgWidth*imgHeight colours
+ * @param imgWidth Width of the image
+ * @param imgHeight Height of the image
+ * @return true The file was written
+ * @return false The file could not be opened
+ */
+bool writePfm(const std::string& path, const vec3* pixels, int imgWidth, int imgHeight);
+
+/**
+ * @brief Tone maps the float image to 8 bits per channel and writes it as a binary PPM file.
+ * Colours are scaled by the exposure, clamped to [0, 1] and raised to 1/gamma.
+ *
+ * @param path Path of the output file
+ * @param pixels Pointer to imgWidth*imgHeight colours, bottom row first
+ * @param imgWidth Width of the image
+ * @param imgHeight Height of the image
+ * @param exposure Linear scale applied before clamping
+ * @param gamma Display gamma, 1 matches the OpenGL window
+ * @return true The file was written
+ * @return false The file could not be opened
+ */
+bool writePpm(const std::string& path, const vec3* pixels, int imgWidth, int imgHeight, float exposure, float gamma);
@@ -17,23 +17,35 @@
  * 
  */
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <thread>
-#include <windows.h>
 
+#ifndef MLT_HEADLESS
+#ifdef _WIN32
+#include <windows.h>
+#endif
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#endif
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtx/string_cast.hpp"
 #include "glm/gtc/type_ptr.hpp"
 #include "stb_image.h"
 
+#include "AccumFilm.hpp"
+#include "AdaptiveSampler.hpp"
+#include "DisplayFormat.hpp"
+#include "Headless.hpp"
 #include "MltPixel.hpp"
+#include "PboRing.hpp"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
 
 #ifdef _MSC_VER
 #define ASSERT(x) if (!(x)) __debugbreak();
@@ -44,6 +56,8 @@
 
 using namespace std;
 
+#ifndef MLT_HEADLESS
+
 /**
  * @brief Clears the OpenGL error stream.
  * 
@@ -90,27 +104,39 @@ string shdrSrc(string path)
 }
 
 /**
- * @brief Thread callback function for rendering a single row of pixels.
+ * @brief Thread pool callback function for rendering a single tile of pixels.
  * 
- * @param y Index of row to render
+ * @param tile Tile of pixels to render
  * @param imgWidth Width of the texture image
  * @param imgHeight Height of the texture image
- * @param frameBuff Pointer to the vec4 frameBuffer for storing the colors
+ * @param film Film accumulating the frames
+ * @param display Image the tile's mean is written to for display, e.g. a mapped PBO
+ * @param format Display format of the image
  * @param done Atomic int to track the number of pixels rendered
+ * @param frame Index of the frame being rendered
  */
-void runXLoop(int y, int imgWidth, int imgHeight, vec4* frameBuff, atomic<int>& done)
+void runTile(const Tile& tile, int imgWidth, int imgHeight, AccumFilm& film, void* display, int format, atomic<int>& done, unsigned frame)
 {
-    for (int x = 0; x < imgWidth; x++) {
-        drawPixel(x, y, imgWidth, imgHeight, frameBuff, done);
+    for (int y = tile.y0; y < tile.y1; y++)
+    {
+        drawPixels(tile.x0, tile.x1, y, imgWidth, imgHeight, film, done, frame, true);
+        film.resolveRow(tile.x0, tile.x1, y, display, format);
     }
 }
 
 /**
- * @brief Main function of the application.
+ * @brief Opens the window and progressively renders into it until it is closed.
+ * With --adaptive E only the tiles above the relative error E keep rendering, and
+ * only the tiles which changed are uploaded. --display rgba16f or rgb9e5 keeps the
+ * display copy in half floats or shared exponents, cutting its memory and upload
+ * bandwidth to a half or a quarter of rgba32f. --tile-size and --tile-order set the
+ * tiles the threads render.
  * 
- * @return int 
+ * @param argc Argument count of main
+ * @param argv Argument vector of main
+ * @return int Exit code of the application
  */
-int main()
+int renderWindow(int argc, char** argv)
 {
     GLFWwindow* window;
     if (!glfwInit())
@@ -129,7 +155,18 @@ int main()
 		cout << "GLAD failed to initialize successfully!! \n";
 		return -1;
 	}
+    int format = parseDisplayFormat(flagValue(argc, argv, "--display", "rgba32f"));
+    if (format < 0)
+    {
+        cout << "ERROR: Unknown display format, expected rgba32f, rgba16f or rgb9e5\n";
+        glfwTerminate();
+        return -1;
+    }
     const int texWid = 900, texHt = 900;
+    /* Every tile writes its mean into a slot of the ring, the texture matches the slots' format */
+    PboRing ring;
+    if (!ring.init(texWid, texHt, format))
+        cout << "No GL 4.4 buffer storage, uploading frames from client memory\n";
     GLuint texOut;
     glGenTextures(1, &texOut);
     glActiveTexture(GL_TEXTURE0);
@@ -138,8 +175,7 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, texWid, texHt, 0, GL_RGBA, GL_FLOAT, NULL);
-    glBindImageTexture(GL_TEXTURE0, texOut, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glTexImage2D(GL_TEXTURE_2D, 0, ring.internalFormat(), texWid, texHt, 0, GL_RGBA, GL_FLOAT, NULL);
     glBindTexture(GL_TEXTURE_2D, 0);
     int wrkGrpCnt[3], wrkGrpInv;
     for (int i = 0; i < 3; i++) 
@@ -221,22 +257,60 @@ int main()
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, meshBlock);
 
+    Scene scene;
+    if (!scene.load("scene.txt"))
+    {
+        glfwTerminate();
+        return -1;
+    }
+    setScene(&scene);
+
     float iter = 0.0f, aperture[4] = {0.0f, 0.0f, 10.0f, 1.0f}, seed = 0.5f, dc = 0.01;
-    vec4* frameBuff = new vec4[texWid*texHt];
+    /* The frames accumulate in the film */
+    AccumFilm film;
+    int tileSize = atoi(flagValue(argc, argv, "--tile-size", to_string(TILE_SIZE).c_str()));
+    int tileOrder = parseTileOrder(flagValue(argc, argv, "--tile-order", "hilbert"));
+    if (tileSize <= 0 || tileOrder < 0)
+    {
+        cout << "ERROR: The tile size must be positive and the tile order scanline, morton or hilbert\n";
+        glfwTerminate();
+        return -1;
+    }
+    film.reset(texWid, texHt, tileSize);
+    float adaptive = max(0.0f, (float)atof(flagValue(argc, argv, "--adaptive", "0")));
+    AdaptiveSampler sampler;
+    sampler.reset(texWid, texHt, tileSize, adaptive);
+    ThreadPool pool;
+    pool.setTileOrder(tileOrder);
+    cout << "Render threads: " << pool.size() << "\n";
+    auto submit = [&](unsigned frameIdx, int slot)
+    {
+        void* display = ring.data(slot);
+        return pool.renderTiles(sampler.activeTiles(),
+            [=, &film](const Tile& tile, atomic<int>& done) { runTile(tile, texWid, texHt, film, display, format, done, frameIdx); });
+    };
+    int slot = ring.acquire();
+    FrameHandle frame = submit(0, slot);
     while (!glfwWindowShouldClose(window))
     {
-        glFinish();
-        atomic<int> done{0};
         set<mvec4> colours;
-        for (int y = 0; y < texHt; y++)
-        {
-            thread(runXLoop, y, texWid, texHt, frameBuff, ref(done)).detach();
-            cout << y << " ";
-        }
-        while (done != texWid*texHt)
+        while (!frame.waitFor(chrono::milliseconds(16)))
         {
-            cout << done << " ";
+            glfwPollEvents();
+            if (glfwWindowShouldClose(window))
+                frame.cancel();
         }
+        if (frame.isCancelled())
+            break;
+        /* Only the tiles the frame rendered need uploading, and they are known before the next frame starts */
+        if (adaptive > 0)
+            sampler.update(film);
+        vector<Tile> dirty = film.takeDirty();
+        /* The next frame traces while this one is uploaded and drawn */
+        int ready = slot;
+        iter += 1.0f;
+        slot = ring.acquire();
+        frame = submit((unsigned)iter, slot);
         for (const mvec4 m : colours)
         {
             cout << m.colour.r << "," << m.colour.g << "," << m.colour.b << " ";
@@ -245,12 +319,7 @@ int main()
         glBindVertexArray(VAO);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, texOut);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, texWid, texHt, 0, GL_RGBA, GL_FLOAT, frameBuff);
-        int iterLoc = glGetUniformLocation(vnfProg, "iter");
-        iter += 1.0f;
-        glEnable(GL_BLEND);
-        glBlendEquation(GL_FUNC_ADD);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        size_t uploaded = ring.upload(ready, dirty);
         glDrawArrays(GL_TRIANGLES, 0, 6);
         glBindBuffer(GL_UNIFORM_BUFFER, meshBlock);
         glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(mesh), mesh);
@@ -258,9 +327,32 @@ int main()
         glUseProgram(0);
         glfwSwapBuffers(window);
         glfwPollEvents();
-        cout << "Rendered frame " << iter << "\n";
+        if (!dirty.empty())
+            cout << "Rendered frame " << iter << ", " << dirty.size() << " tiles, " << uploaded/1e6 << " MB uploaded\n";
     }
-    while (1);
+    /* The frame in flight writes into the film and the ring */
+    frame.cancel();
+    frame.wait();
+    ring.release();
     glfwTerminate();
     return 0;
-}
\ No newline at end of file
+}
+
+#endif
+
+/**
+ * @brief Main function of the application. Runs the offline renderer when built with
+ * MLT_HEADLESS or started with --headless, otherwise opens the OpenGL window.
+ * 
+ * @param argc Argument count
+ * @param argv Arguments, see renderHeadless for the headless flags
+ * @return int 
+ */
+int main(int argc, char** argv)
+{
+#ifndef MLT_HEADLESS
+    if (!hasFlag(argc, argv, "--headless"))
+        return renderWindow(argc, argv);
+#endif
+    return renderHeadless(argc, argv);
+}
@@ -18,9 +18,26 @@
 
 #include "glm/glm.hpp"
 
-#define NUM_HITS 10
-#define SAMPLES 1
-#define MUTATIONS 100
+#include "Rng.hpp"
+
+/* Upper bound of RenderConfig::maxHits, sizes the paths of the generic kernels */
+#define MAX_HITS 32
+/* Highest Russian roulette survival probability, so that paths through white mirrors end as well */
+#define RR_MAX_SURVIVAL 0.95f
+#define PACKET_SIZE 8
+
+/* Sample the emitters at every bounce and combine them with the BSDF samples by MIS */
+#define NEXT_EVENT 1
+
+/* SampleHemi() and SmoothnessToPhongAlpha() use the polynomials of FastMath.hpp instead of libm */
+#define FAST_SAMPLING 0
+/* log2(1000), SmoothnessToPhongAlpha() is 2^(s*s*log2(1000)) */
+#define LOG2_1000 9.96578428f
+
+/* Random numbers Shade() draws per bounce: lobe and direction, plus emitter, and point on it */
+#define SHADE_DIMS 6
+/* Random numbers a path draws per bounce, Shade() followed by Survives() */
+#define BOUNCE_DIMS (SHADE_DIMS + 1)
 
 #define ivec2 glm::ivec2
 #define vec2 glm::highp_f32vec2
@@ -29,6 +46,21 @@
 #define mat3 glm::highp_f32mat3
 #define mat4 glm::highp_f32mat4
 
+/**
+ * @brief Struct containing the integrator parameters which can change per render
+ * 
+ */
+struct RenderConfig
+{
+	/* Paths end after maxHits bounces at the latest, Russian roulette may end them from minHits on */
+	int maxHits = 10;
+	int minHits = 3;
+	/* Paths averaged per pixel before the mutations start */
+	int samples = 1;
+	/* Mutations of every pixel's Markov chain */
+	int mutations = 100;
+};
+
 /**
  * @brief Struct for a single Ray
  * 
@@ -38,44 +70,158 @@ struct Ray
 	vec3 dir;
 	vec3 nrg;
 	vec3 org;
+	/* Solid angle density Shade() sampled dir with, 0 for rays which were not scattered */
+	float pdf = 0;
 };
 
 /**
- * @brief Struct for a single hit by a Ray on any surface
+ * @brief Struct for the shadow ray of a next event estimate and the light it adds if
+ * nothing is closer than maxDist. maxDist is 0 if there is nothing to trace.
  * 
  */
-struct RayHit
+struct ShadowRay
+{
+	Ray ray;
+	float maxDist;
+	vec3 light;
+};
+
+/* Lobes Shade() scatters a ray by */
+#define LOBE_SPECULAR 0
+#define LOBE_DIFFUSE 1
+
+/**
+ * @brief Struct for the lobe Shade() picked at a hit, and the random numbers which sample
+ * the direction in it. The throughput is multiplied by weight, and for the specular lobe
+ * by the clamped cosine term as well.
+ * 
+ */
+struct LobeSample
+{
+	int lobe;
+	vec3 axis;
+	float smoothness;
+	vec3 weight;
+	float uCos;
+	float uPhi;
+};
+
+/**
+ * @brief Struct containing the surface properties shared by every primitive using it
+ * 
+ */
+struct Material
 {
-	double dist;
-	double smoothness;
-	bool skybox;
 	vec3 albedo;
+	vec3 specular;
 	vec3 emission;
+	float smoothness;
+};
+
+/* Kind of primitive a HitRecord refers to, kept in the top bits of its prim */
+#define HIT_TRIANGLE 0x00000000u
+#define HIT_SPHERE 0x40000000u
+#define HIT_PLANE 0x80000000u
+#define HIT_SKYBOX 0xC0000000u
+#define HIT_KIND_MASK 0xC0000000u
+
+/**
+ * @brief Struct for the compact hit record written while looking for the closest hit.
+ * Only the distance and the ids are updated on every closer hit, the surface is fetched
+ * with FetchHit() once the closest one is known.
+ * 
+ */
+struct HitRecord
+{
+	/* Distance along the ray, -1 before anything was hit */
+	float t;
+	/* Index of the primitive within its kind, ORed with its HIT_ kind */
+	uint32_t prim;
+	/* Index of the material in the scene, -1 for the skybox */
+	int mat;
+	/* Barycentric coordinates of triangle hits */
+	vec2 bary;
+};
+
+/**
+ * @brief Struct for a single hit by a Ray on any surface, with the attributes of the
+ * surface fetched
+ * 
+ */
+struct RayHit
+{
+	float dist;
+	bool skybox;
 	vec3 norm;
 	vec3 pos;
-	vec3 specular;
+	const Material* mat;
 };
 
 /**
- * @brief Struct containing a single node of a Path
+ * @brief Struct containing a single node of a path in a PathPool
  * 
  */
 struct PathNode
 {
-	RayHit hit;
+	HitRecord hit;
 	Ray ray;
 	vec3 rslt;
+	/* Next node of the current path, -1 at its end. Free nodes chain through it as well. */
 	int nextA;
+	/* First node of a proposal's suffix diverging after this node, -1 if there is none */
 	int nextM;
 };
 
 /**
- * @brief Struct containing a single Path
+ * @brief Struct containing the nodes of one Markov chain's paths of up to Len nodes.
+ * The current path follows nextA from its first node. A proposal shares the prefix up to
+ * the node it diverges after and hangs its re-traced suffix off that node's nextM, so
+ * accepting or rejecting it only relinks the diverging node and hands the losing suffix
+ * back to the free list. Both suffixes together never need more than 2*Len nodes.
  * 
  */
-struct Path 
+template <int Len>
+struct PathPool
 {
-	PathNode nodes[NUM_HITS];
+	PathNode nodes[2*Len];
+	int freeList;
+
+	/**
+	 * @brief Marks every node as free
+	 * 
+	 */
+	void reset()
+	{
+		for (int i = 0; i < 2*Len; i++)
+		{
+			nodes[i].nextA = i + 1 < 2*Len ? i + 1 : -1;
+			nodes[i].nextM = -1;
+		}
+		freeList = 0;
+	}
+
+	/**
+	 * @brief Takes an unlinked node from the free list
+	 * 
+	 */
+	int alloc()
+	{
+		int n = freeList;
+		freeList = nodes[n].nextA;
+		nodes[n].nextA = -1;
+		nodes[n].nextM = -1;
+		return n;
+	}
+
+	/**
+	 * @brief Returns the nextA chain from first to last to the free list
+	 * 
+	 */
+	void release(int first, int last)
+	{
+		nodes[last].nextA = freeList;
+		freeList = first;
+	}
 };
 
 /**
@@ -105,6 +251,31 @@ struct mvec4
 	{}
 };
 
+struct Scene;
+struct AccumFilm;
+
+/**
+ * @brief Sets the scene traced by every subsequent render. The scene must outlive the render.
+ * 
+ * @param scene Scene to trace
+ */
+void setScene(const Scene* scene);
+
+/**
+ * @brief Sets the integrator parameters of every subsequent render
+ * 
+ * @param cfg Parameters to use
+ * @return true The parameters were applied
+ * @return false The parameters are out of range and were ignored
+ */
+bool setConfig(const RenderConfig& cfg);
+
+/**
+ * @brief Returns the integrator parameters in use
+ * 
+ */
+const RenderConfig& getConfig();
+
 /**
  * @brief Shoots the ray and returns the ray hit point.
  * 
@@ -119,9 +290,150 @@ RayHit Trc(Ray ray);
  * 
  * @param ray Ray to be updated
  * @param hit RayHit to be used for updating the ray
- * @param e2 Random Generating Engine
- * @param dist Random Distribution
+ * @param rng Counter-based generator of the current pixel sample
  * @return vec3 Color result for the given ray and ray hit.
  */
-vec3 Shd(Ray& ray, RayHit hit, std::mt19937& e2, std::uniform_real_distribution<double>& dist);
-void drawPixel(int x, int y, int imgWid, int imgHt, vec4* frmBuff, std::atomic<int>& done);
\ No newline at end of file
+vec3 Shd(Ray& ray, RayHit hit, Rng& rng);
+
+/**
+ * @brief Returns a RayHit which has not hit anything yet
+ * 
+ */
+RayHit CreateRayHit();
+
+/**
+ * @brief Returns a HitRecord which has not hit anything yet
+ * 
+ */
+HitRecord CreateHitRecord();
+
+/**
+ * @brief Fetches position, normal and material of the surface the record refers to
+ * 
+ * @param ray Ray which produced the record
+ * @param rec Closest hit of the ray
+ * @return RayHit Hit surface
+ */
+RayHit FetchHit(const Ray& ray, const HitRecord& rec);
+
+/**
+ * @brief Samples a direction around norm with density (alpha + 1)/(2 pi) cos^alpha
+ * 
+ */
+vec3 SampleHemi(vec3 norm, float alpha, Rng& rng);
+
+/**
+ * @brief SampleHemi() with the two random numbers it draws given
+ * 
+ */
+vec3 SampleHemi(vec3 norm, float alpha, float uCos, float uPhi);
+
+/**
+ * @brief Evaluates the BSDF which Shade() samples, wi and wo point away from the hit
+ * 
+ */
+vec3 EvalBsdf(const RayHit& hit, vec3 wi, vec3 wo);
+
+/**
+ * @brief Returns the solid angle density of Shade() scattering towards wo after arriving from wi
+ * 
+ */
+float PdfBsdf(const RayHit& hit, vec3 wi, vec3 wo);
+
+/**
+ * @brief Samples a scattered direction the same way as Shade()
+ * 
+ */
+vec3 SampleBsdf(const RayHit& hit, vec3 wi, Rng& rng);
+
+/**
+ * @brief Shoots the ray into the scene set by setScene() and returns the record of the closest hit.
+ * Triangles are only hit from the front unless twoSided is set.
+ * 
+ */
+HitRecord TraceRecord(const Ray& ray, bool twoSided = false);
+
+/**
+ * @brief Shoots the ray into the scene set by setScene() and returns the closest hit. A
+ * triangle hit from behind keeps its normal, which then faces away from the ray.
+ * 
+ */
+RayHit Trace(Ray ray, bool twoSided = false);
+
+/**
+ * @brief Traces up to PACKET_SIZE rays together, with the same records as TraceRecord()
+ * 
+ */
+void TracePacket(const Ray* rays, HitRecord* hits, int n);
+
+/**
+ * @brief Returns true if any surface of the scene other than the skybox is hit by the ray
+ * closer than maxDist. Stops at the first such hit. Triangles only block the ray from the
+ * front unless twoSided is set.
+ * 
+ */
+bool Occluded(const Ray& ray, float maxDist, bool twoSided = false);
+
+/**
+ * @brief Shade() without the visibility test of its next event estimate: scatters the
+ * ray and returns the emission found, and the shadow ray whose light is added to it if
+ * Occluded() finds nothing in the way. Draws the same random numbers as Shade().
+ * 
+ */
+vec3 ShadeDeferred(Ray& ray, const RayHit& hit, Rng& rng, ShadowRay& shadow);
+
+/**
+ * @brief The part of ShadeDeferred() before the direction is sampled, for a hit on a
+ * surface other than the skybox: returns the emission found and the shadow ray, moves
+ * the ray's origin off the surface and picks the lobe. Draws the same random numbers.
+ * 
+ */
+vec3 ShadeLobe(Ray& ray, const RayHit& hit, Rng& rng, ShadowRay& shadow, LobeSample& lobe);
+
+/**
+ * @brief Returns the camera ray through the given pixel
+ * 
+ */
+Ray primaryRay(int x, int y, int imgWid, int imgHt);
+
+/**
+ * @brief Returns the camera ray through the given pixel with its direction not yet
+ * normalized, for callers which normalize many of them at once with BatchNormalize()
+ * 
+ */
+Ray primaryRayUnnormalized(int x, int y, int imgWid, int imgHt);
+
+/**
+ * @brief Returns the luminance of the given color
+ * 
+ */
+float luminance(vec3 colour);
+
+/**
+ * @brief Russian roulette on the throughput of the ray after its given bounce. A surviving
+ * ray has its throughput divided by the survival probability, which keeps the estimate unbiased.
+ * 
+ * @return true The path continues
+ * @return false The path ends, its throughput is zero
+ */
+bool Survives(Ray& ray, int hits, Rng& rng);
+
+/**
+ * @brief Follows a path from the given camera ray for up to RenderConfig::maxHits bounces and returns
+ * the radiance it carries back, drawing every random number from rng.
+ * 
+ */
+vec3 TracePath(Ray ray, Rng& rng);
+
+/**
+ * @brief Renders one frame's estimate of the pixel and adds it to the film
+ * 
+ */
+void drawPixel(int x, int y, int imgWid, int imgHt, AccumFilm& film, std::atomic<int>& done, unsigned frame, const HitRecord* primaryHit = nullptr);
+
+/**
+ * @brief Renders the pixels [x0, x1) of row y, tracing the camera rays PACKET_SIZE at a time
+ * when packets is set. The random numbers of every pixel depend only on its position and frame.
+ * 
+ */
+void drawPixels(int x0, int x1, int y, int imgWid, int imgHt, AccumFilm& film, std::atomic<int>& done, unsigned frame, bool packets);
\ No newline at end of file
@@ -0,0 +1,125 @@
+/**
+ * @file PboRing.cpp
+ * @author
+ * @brief Contains the implementation of the pixel buffer ring
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef MLT_HEADLESS
+
+#include "PboRing.hpp"
+
+using namespace std;
+
+void PboRing::release()
+{
+	for (int i = 0; i < PBO_SLOTS; i++)
+	{
+		if (fence[i])
+			glDeleteSync(fence[i]);
+		fence[i] = 0;
+		if (!ptr[i])
+			continue;
+		if (persistent)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		else
+			delete[] ptr[i];
+		ptr[i] = nullptr;
+	}
+	if (persistent)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(PBO_SLOTS, pbo);
+		persistent = false;
+	}
+}
+
+bool PboRing::init(int width, int height, int fmt)
+{
+	imgWidth = width;
+	imgHeight = height;
+	format = fmt;
+	pixelSize = displayPixelSize(fmt);
+	persistent = GLAD_GL_VERSION_4_4 != 0;
+	GLsizeiptr size = GLsizeiptr(width)*height*pixelSize;
+	if (!persistent)
+	{
+		for (int i = 0; i < PBO_SLOTS; i++)
+			ptr[i] = new char[size];
+		return false;
+	}
+
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(PBO_SLOTS, pbo);
+	for (int i = 0; i < PBO_SLOTS; i++)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+		ptr[i] = (char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return true;
+}
+
+int PboRing::acquire()
+{
+	int slot = next;
+	next = (next + 1)%PBO_SLOTS;
+	if (fence[slot])
+	{
+		while (glClientWaitSync(fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+			;
+		glDeleteSync(fence[slot]);
+		fence[slot] = 0;
+	}
+	return slot;
+}
+
+size_t PboRing::upload(int slot, const vector<Tile>& rects)
+{
+	if (rects.empty())
+		return 0;
+	/* The copy reads from the buffer once the GPU gets to it, the fence marks when it has */
+	if (persistent)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[slot]);
+	GLenum pixFormat = format == DISPLAY_RGB9E5 ? GL_RGB : GL_RGBA;
+	GLenum pixType = format == DISPLAY_RGB9E5 ? GL_UNSIGNED_INT_5_9_9_9_REV : format == DISPLAY_RGBA16F ? GL_HALF_FLOAT : GL_FLOAT;
+	size_t bytes = 0;
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, imgWidth);
+	for (const Tile& r : rects)
+	{
+		size_t offset = (size_t(r.y0)*imgWidth + r.x0)*pixelSize;
+		const void* src = persistent ? (const void*)offset : (const void*)(ptr[slot] + offset);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, pixFormat, pixType, src);
+		bytes += size_t(r.x1 - r.x0)*(r.y1 - r.y0)*pixelSize;
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	if (persistent)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	return bytes;
+}
+
+GLenum PboRing::internalFormat() const
+{
+	switch (format)
+	{
+	case DISPLAY_RGBA16F:
+		return GL_RGBA16F;
+	case DISPLAY_RGB9E5:
+		return GL_RGB9_E5;
+	default:
+		return GL_RGBA32F;
+	}
+}
+
+#endif
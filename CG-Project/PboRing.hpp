@@ -0,0 +1,112 @@
+#pragma once
+
+/**
+ * @file PboRing.hpp
+ * @author
+ * @brief Contains the ring of persistently mapped pixel buffers feeding the display texture
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef MLT_HEADLESS
+
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "DisplayFormat.hpp"
+#include "MltPixel.hpp"
+#include "ThreadPool.hpp"
+
+/* Frames in flight between the render threads and the GPU */
+#define PBO_SLOTS 3
+
+/**
+ * @brief Class holding PBO_SLOTS images in one of the display formats in pixel unpack
+ * buffers which stay mapped for the whole run. Render threads write a frame straight into a slot while the GPU
+ * still copies earlier slots into the texture, and a fence per slot keeps a slot from
+ * being refilled before its copy has finished. Without GL 4.4 buffer storage the slots
+ * are plain client memory and uploads are synchronous.
+ *
+ */
+class PboRing
+{
+public:
+	PboRing() = default;
+	~PboRing()
+	{
+		release();
+	}
+
+	PboRing(const PboRing&) = delete;
+	PboRing& operator=(const PboRing&) = delete;
+
+	/**
+	 * @brief Creates and maps the buffers. Needs a current GL context.
+	 *
+	 * @param width Width of the texture
+	 * @param height Height of the texture
+	 * @param fmt Display format of the slots, which the texture has to match
+	 * @return true The slots are persistently mapped buffers
+	 * @return false Buffer storage is unavailable, the slots are client memory
+	 */
+	bool init(int width, int height, int fmt = DISPLAY_RGBA32F);
+
+	/**
+	 * @brief Returns the next slot to fill, after waiting for the GPU to finish reading it
+	 *
+	 */
+	int acquire();
+
+	/**
+	 * @brief Returns the width*height pixels of the slot in the display format, bottom row first
+	 *
+	 */
+	void* data(int slot)
+	{
+		return ptr[slot];
+	}
+
+	/**
+	 * @brief Copies the given rectangles of a filled slot into the bound GL_TEXTURE_2D and
+	 * fences the slot. Only the rectangles have to hold valid pixels.
+	 *
+	 * @param slot Slot to copy from
+	 * @param rects Rectangles to copy, e.g. AccumFilm::takeDirty()
+	 * @return size_t Bytes uploaded
+	 */
+	size_t upload(int slot, const std::vector<Tile>& rects);
+
+	/**
+	 * @brief Unmaps and deletes the buffers while the context is still current
+	 *
+	 */
+	void release();
+
+	bool isPersistent() const
+	{
+		return persistent;
+	}
+
+	/**
+	 * @brief Returns the internal format of a GL_TEXTURE_2D the slots can be uploaded to
+	 *
+	 */
+	GLenum internalFormat() const;
+
+private:
+	int imgWidth = 0;
+	int imgHeight = 0;
+	int next = 0;
+	int format = DISPLAY_RGBA32F;
+	int pixelSize = 16;
+	bool persistent = false;
+	GLuint pbo[PBO_SLOTS] = {};
+	GLsync fence[PBO_SLOTS] = {};
+	char* ptr[PBO_SLOTS] = {};
+};
+
+#endif
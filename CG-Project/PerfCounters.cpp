@@ -0,0 +1,107 @@
+/**
+ * @file PerfCounters.cpp
+ * @author
+ * @brief Contains the Linux implementation of the cache counters
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifdef __linux__
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "PerfCounters.hpp"
+
+using namespace std;
+
+#ifdef __linux__
+
+PerfCounters::~PerfCounters()
+{
+	for (int& fd : fds)
+	{
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+	}
+}
+
+bool PerfCounters::open()
+{
+	const unsigned long long l1dMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	const unsigned types[PERF_EVENTS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE};
+	const unsigned long long configs[PERF_EVENTS] = {PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES, l1dMiss};
+	bool any = false;
+	for (int i = 0; i < PERF_EVENTS; i++)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = types[i];
+		attr.config = configs[i];
+		attr.disabled = 1;
+		attr.inherit = 1;
+		/* Counting only user space works without privileges on the default perf_event_paranoid */
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		any |= fds[i] >= 0;
+	}
+	return any;
+}
+
+void PerfCounters::start()
+{
+	for (int fd : fds)
+		if (fd >= 0)
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+void PerfCounters::stop()
+{
+	for (int fd : fds)
+		if (fd >= 0)
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+long long PerfCounters::count(int event) const
+{
+	long long value = 0;
+	if (fds[event] < 0 || read(fds[event], &value, sizeof(value)) != sizeof(value))
+		return -1;
+	return value;
+}
+
+#else
+
+PerfCounters::~PerfCounters()
+{
+}
+
+bool PerfCounters::open()
+{
+	return false;
+}
+
+void PerfCounters::start()
+{
+}
+
+void PerfCounters::stop()
+{
+}
+
+long long PerfCounters::count(int event) const
+{
+	return -1;
+}
+
+#endif
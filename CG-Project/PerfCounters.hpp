@@ -0,0 +1,65 @@
+#pragma once
+
+/**
+ * @file PerfCounters.hpp
+ * @author
+ * @brief Contains the hardware cache counters the headless benchmark reports
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+/* Events counted, in the order of PerfCounters::count() */
+#define PERF_CACHE_REFS 0
+#define PERF_CACHE_MISSES 1
+#define PERF_L1D_MISSES 2
+#define PERF_EVENTS 3
+
+/**
+ * @brief Class counting last level cache references and misses and L1 data cache load
+ * misses of the process with perf_event_open. The counters follow threads started after
+ * open(), so they have to be opened before the thread pool. Other platforms, and kernels
+ * or virtual machines which do not expose the events, count nothing.
+ *
+ */
+class PerfCounters
+{
+public:
+	PerfCounters() = default;
+	~PerfCounters();
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	/**
+	 * @brief Opens the counters, stopped
+	 *
+	 * @return true At least one event can be counted
+	 * @return false No event is available
+	 */
+	bool open();
+
+	/**
+	 * @brief Starts or resumes counting
+	 *
+	 */
+	void start();
+
+	/**
+	 * @brief Pauses counting
+	 *
+	 */
+	void stop();
+
+	/**
+	 * @brief Returns the count of an event over all threads, or -1 if it is not counted
+	 *
+	 * @param event One of the PERF_ events
+	 */
+	long long count(int event) const;
+
+private:
+	int fds[PERF_EVENTS] = {-1, -1, -1};
+};
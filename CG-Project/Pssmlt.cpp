@@ -0,0 +1,174 @@
+/**
+ * @file Pssmlt.cpp
+ * @author
+ * @brief Contains the implementation of the primary sample space MLT engine
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "Pssmlt.hpp"
+
+using namespace std;
+
+/**
+ * @brief Fills a primary sample vector with independent uniform numbers
+ *
+ */
+static void mutateLarge(float* x, int dims, Rng& rng)
+{
+	for (int i = 0; i < dims; i++)
+		x[i] = rng.next();
+}
+
+/**
+ * @brief Perturbs every primary sample by an exponentially distributed offset in
+ * [PSS_S1, PSS_S2], wrapping around at the borders of the unit interval
+ *
+ */
+static void mutateSmall(float* x, int dims, Rng& rng)
+{
+	for (int i = 0; i < dims; i++)
+	{
+		float dv = PSS_S2*exp(-log(PSS_S2/PSS_S1)*rng.next());
+		if (rng.next() < 0.5f)
+		{
+			x[i] += dv;
+			if (x[i] >= 1.0f)
+				x[i] -= 1.0f;
+		}
+		else
+		{
+			x[i] -= dv;
+			if (x[i] < 0.0f)
+				x[i] += 1.0f;
+		}
+	}
+}
+
+void Pssmlt::evaluate(const float* x, int& pix, vec3& f) const
+{
+	Rng rng(x, dims);
+	int px = min(int(rng.next()*imgWidth), imgWidth - 1);
+	int py = min(int(rng.next()*imgHeight), imgHeight - 1);
+	pix = py*imgWidth + px;
+	f = TracePath(primaryRay(px, py, imgWidth, imgHeight), rng);
+	if (!isfinite(f.x) || !isfinite(f.y) || !isfinite(f.z))
+		f = vec3(0.0f);
+}
+
+bool Pssmlt::init(ThreadPool& pool, int width, int height, int numChains, int numSamples, unsigned seed)
+{
+	imgWidth = width;
+	imgHeight = height;
+	this->seed = seed;
+	dims = 2 + BOUNCE_DIMS*getConfig().maxHits;
+	mutations = 0;
+	film.reset(width, height);
+
+	/* Bootstrap path i is the large step drawn from stream i of frame 0 */
+	vector<float> lums(numSamples);
+	FrameHandle frame = pool.renderFrame(numSamples, 1, TILE_SIZE,
+		[&](const Tile& tile, atomic<int>& done)
+		{
+			float x[PSS_MAX_DIMS];
+			for (int i = tile.x0; i < tile.x1; i++)
+			{
+				Rng rng(i, 0, 0, seed);
+				mutateLarge(x, dims, rng);
+				int pix;
+				vec3 f;
+				evaluate(x, pix, f);
+				lums[i] = luminance(f);
+				done++;
+			}
+		});
+	frame.wait();
+
+	vector<double> cdf(numSamples + 1, 0.0);
+	for (int i = 0; i < numSamples; i++)
+		cdf[i + 1] = cdf[i] + lums[i];
+	b = cdf[numSamples]/numSamples;
+	if (b <= 0)
+	{
+		cout << "ERROR: None of the " << numSamples << " bootstrap paths carried light\n";
+		return false;
+	}
+
+	/* Stratified selection of the starting paths in proportion to their luminance */
+	chains.resize(numChains);
+	for (int c = 0; c < numChains; c++)
+	{
+		double u = (c + 0.5)/numChains*cdf[numSamples];
+		int i = int(upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1;
+		i = min(max(i, 0), numSamples - 1);
+		PssChain& chain = chains[c];
+		Rng rng(i, 0, 0, seed);
+		mutateLarge(chain.x, dims, rng);
+		evaluate(chain.x, chain.pix, chain.f);
+		chain.lum = luminance(chain.f);
+		chain.index = c;
+	}
+	return true;
+}
+
+void Pssmlt::mutateChain(PssChain& chain, int numMutations, unsigned iteration)
+{
+	/* The chains use the pixel slot of the counter key for their index, frame 0 is the bootstrap */
+	Rng rng(chain.index, iteration + 1, 0, seed);
+	PssChain prop = chain;
+	for (int m = 0; m < numMutations; m++)
+	{
+		copy(chain.x, chain.x + dims, prop.x);
+		if (rng.next() < largeStep)
+			mutateLarge(prop.x, dims, rng);
+		else
+			mutateSmall(prop.x, dims, rng);
+		evaluate(prop.x, prop.pix, prop.f);
+		prop.lum = luminance(prop.f);
+
+		/* Both states are splatted with their expected weights, independent of the outcome */
+		float a = chain.lum > 0 ? min(1.0f, prop.lum/chain.lum) : 1.0f;
+		if (prop.lum > 0)
+			film.splat(prop.pix, prop.f*(a/prop.lum));
+		if (chain.lum > 0)
+			film.splat(chain.pix, chain.f*((1.0f - a)/chain.lum));
+		if (rng.next() < a)
+		{
+			copy(prop.x, prop.x + dims, chain.x);
+			chain.pix = prop.pix;
+			chain.f = prop.f;
+			chain.lum = prop.lum;
+		}
+	}
+	mutations += numMutations;
+}
+
+FrameHandle Pssmlt::iterate(ThreadPool& pool, int mutationsPerChain, unsigned iteration)
+{
+	return pool.renderFrame((int)chains.size(), 1, 1,
+		[this, mutationsPerChain, iteration](const Tile& tile, atomic<int>& done)
+		{
+			for (int c = tile.x0; c < tile.x1; c++)
+			{
+				mutateChain(chains[c], mutationsPerChain, iteration);
+				done++;
+			}
+		});
+}
+
+void Pssmlt::resolve(vec3* img) const
+{
+	int numPix = imgWidth*imgHeight;
+	long long n = mutations.load();
+	/* Each mutation deposits total weight one, so the film sums to n and has to be scaled to b per pixel */
+	float scale = n > 0 ? float(b*numPix/n) : 0.0f;
+	for (int i = 0; i < numPix; i++)
+		img[i] = film.get(i)*scale;
+}
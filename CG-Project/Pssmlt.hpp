@@ -0,0 +1,117 @@
+#pragma once
+
+/**
+ * @file Pssmlt.hpp
+ * @author
+ * @brief Contains the primary sample space Metropolis light transport engine (Kelemen et al. 2002)
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <atomic>
+#include <vector>
+
+#include "MltPixel.hpp"
+#include "SplatFilm.hpp"
+#include "ThreadPool.hpp"
+
+/* Dimensions of the longest primary sample vector: the pixel followed by the numbers of every bounce */
+#define PSS_MAX_DIMS (2 + BOUNCE_DIMS*MAX_HITS)
+
+/* Probability of a large step, which draws a fresh independent path */
+#define PSS_LARGE_STEP 0.3f
+
+/* Range of the exponential small step perturbation of a single primary sample */
+#define PSS_S1 (1.0f/1024.0f)
+#define PSS_S2 (1.0f/64.0f)
+
+/**
+ * @brief Struct for the state of one Markov chain: its current primary sample vector
+ * together with the pixel and radiance the vector maps to.
+ *
+ */
+struct PssChain
+{
+	float x[PSS_MAX_DIMS];
+	int pix;
+	vec3 f;
+	float lum;
+	unsigned index;
+};
+
+/**
+ * @brief Struct containing the global Markov chains. Unlike the per-pixel chains of
+ * drawPixel(), every chain wanders over the whole image and splats its contributions
+ * wherever its current path lands, so energy found through a hard to hit light path is
+ * shared with every pixel that light path can reach.
+ *
+ */
+struct Pssmlt
+{
+	int imgWidth = 0;
+	int imgHeight = 0;
+	float largeStep = PSS_LARGE_STEP;
+
+	/* Used dimensions of the primary sample vectors, from the maxHits of the configuration */
+	int dims = 0;
+
+	/* Average luminance of the image, estimated while bootstrapping */
+	double b = 0;
+
+	/* Mutations splatted into the film so far */
+	std::atomic<long long> mutations;
+
+	std::vector<PssChain> chains;
+
+	SplatFilm film;
+
+	Pssmlt() : mutations(0)
+	{}
+
+	/**
+	 * @brief Estimates the normalization b from independent paths and starts every chain
+	 * on one of them, picked in proportion to its luminance. Paths are as long as the
+	 * configuration set with setConfig() allows.
+	 *
+	 * @param pool Threads tracing the bootstrap paths
+	 * @param width Width of the image
+	 * @param height Height of the image
+	 * @param numChains Number of Markov chains
+	 * @param numSamples Number of independent bootstrap paths
+	 * @param seed Seed of every random number used by the chains
+	 * @return true The chains were started
+	 * @return false No bootstrap path carried any light
+	 */
+	bool init(ThreadPool& pool, int width, int height, int numChains, int numSamples, unsigned seed = 0);
+
+	/**
+	 * @brief Starts mutating every chain in parallel
+	 *
+	 * @param pool Threads running the chains, one chain per task
+	 * @param mutationsPerChain Mutations each chain performs
+	 * @param iteration Index of the iteration, keys the random numbers of the mutations
+	 * @return FrameHandle Handle of the iteration, counting one per finished chain
+	 */
+	FrameHandle iterate(ThreadPool& pool, int mutationsPerChain, unsigned iteration);
+
+	/**
+	 * @brief Writes the current estimate of the image, bottom row first
+	 *
+	 * @param img Image of imgWidth*imgHeight pixels
+	 */
+	void resolve(vec3* img) const;
+
+private:
+	unsigned seed = 0;
+
+	/**
+	 * @brief Maps a primary sample vector to a pixel and traces its path
+	 *
+	 */
+	void evaluate(const float* x, int& pix, vec3& f) const;
+
+	void mutateChain(PssChain& chain, int numMutations, unsigned iteration);
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+/**
+ * @file Rng.hpp
+ * @author
+ * @brief Contains the counter-based random number generator used by the shaders
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <cmath>
+#include <cstdint>
+
+/**
+ * @brief Counter-based random number generator (Philox4x32-10). Every number is a pure
+ * function of (seed, pixel, frame, sample, dimension), so creating a generator costs
+ * nothing and renders are reproducible regardless of thread scheduling.
+ *
+ */
+struct Rng
+{
+	uint32_t seed;
+	uint32_t pixel;
+	uint32_t frame;
+	uint32_t sample;
+	uint32_t dimension;
+
+	Rng(uint32_t pixel, uint32_t frame, uint32_t sample = 0, uint32_t seed = 0) : seed(seed), pixel(pixel), frame(frame), sample(sample), dimension(0)
+	{}
+
+	/**
+	 * @brief Creates a generator replaying the given primary samples, as mutated by the
+	 * PSSMLT chains. Dimensions beyond numSamples fall back to Philox output.
+	 *
+	 */
+	Rng(const float* samples, uint32_t numSamples) : seed(0), pixel(0), frame(0), sample(0), dimension(0), samples(samples), numSamples(numSamples)
+	{}
+
+	/**
+	 * @brief Restarts the generator at dimension 0 of another sample
+	 *
+	 */
+	void setSample(uint32_t s)
+	{
+		sample = s;
+		dimension = 0;
+		cached = 4;
+	}
+
+	/**
+	 * @brief Continues the current sample at the given dimension, so a path can be
+	 * resumed from the dimension it stopped at
+	 *
+	 */
+	void seek(uint32_t dim)
+	{
+		dimension = dim;
+		cached = 4;
+		if (dim%4)
+		{
+			philox(dim - dim%4, sample, frame, 0);
+			cached = dim%4;
+		}
+	}
+
+	/**
+	 * @brief Returns the next 32 random bits of the current sample
+	 *
+	 */
+	uint32_t nextUint()
+	{
+		if (cached == 4)
+		{
+			philox(dimension, sample, frame, 0);
+			cached = 0;
+		}
+		dimension++;
+		return out[cached++];
+	}
+
+	/**
+	 * @brief Returns a uniform float in [0, 1)
+	 *
+	 */
+	float next()
+	{
+		if (dimension < numSamples)
+			return samples[dimension++];
+		return (nextUint() >> 8)*(1.0f/16777216.0f);
+	}
+
+	/**
+	 * @brief Returns a normally distributed float (Box-Muller)
+	 *
+	 * @param mean Mean of the distribution
+	 * @param stddev Standard deviation of the distribution
+	 */
+	float normal(float mean, float stddev)
+	{
+		float u1 = 1.0f - next(), u2 = next();
+		return mean + stddev*std::sqrt(-2.0f*std::log(u1))*std::cos(6.2831853f*u2);
+	}
+
+private:
+	const float* samples = nullptr;
+	uint32_t numSamples = 0;
+	uint32_t out[4];
+	int cached = 4;
+
+	static uint32_t mulhilo(uint32_t a, uint32_t b, uint32_t& hi)
+	{
+		uint64_t p = uint64_t(a)*b;
+		hi = uint32_t(p >> 32);
+		return uint32_t(p);
+	}
+
+	/**
+	 * @brief Ten Philox rounds over the counter (c0..c3) with the key (pixel, seed)
+	 *
+	 */
+	void philox(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3)
+	{
+		uint32_t k0 = pixel, k1 = seed;
+		for (int i = 0; i < 10; i++)
+		{
+			uint32_t hi0, hi1;
+			uint32_t lo0 = mulhilo(0xD2511F53u, c0, hi0);
+			uint32_t lo1 = mulhilo(0xCD9E8D57u, c2, hi1);
+			c0 = hi1 ^ c1 ^ k0;
+			c1 = lo1;
+			c2 = hi0 ^ c3 ^ k1;
+			c3 = lo0;
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+		out[0] = c0;
+		out[1] = c1;
+		out[2] = c2;
+		out[3] = c3;
+	}
+};
@@ -0,0 +1,184 @@
+/**
+ * @file Scene.cpp
+ * @author
+ * @brief Contains the implementation of the scene storage and the scene file loader
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "Scene.hpp"
+
+using namespace std;
+
+int Scene::addMaterial(const string& name, vec3 albedo, vec3 specular, float smoothness, vec3 emission)
+{
+	Material m;
+	m.albedo = albedo;
+	m.specular = specular;
+	m.emission = emission;
+	m.smoothness = smoothness;
+	matName.push_back(name);
+	mats.push_back(m);
+	return (int)matName.size() - 1;
+}
+
+void Scene::addSphere(vec3 pos, float rad, int mat)
+{
+	sphPos.push_back(pos);
+	sphRad.push_back(rad);
+	sphMat.push_back(mat);
+}
+
+void Scene::addTriangle(vec3 vert0, vec3 vert1, vec3 vert2, int mat)
+{
+	vec3 edge1 = vert1 - vert0, edge2 = vert2 - vert0;
+	tglVert0.push_back(vert0);
+	tglEdge1.push_back(edge1);
+	tglEdge2.push_back(edge2);
+	tglNorm.push_back(normalize(cross(edge1, edge2)));
+	tglMat.push_back(mat);
+}
+
+void Scene::addPlane(vec3 norm, float dist, int mat)
+{
+	plnNorm.push_back(normalize(norm));
+	plnDist.push_back(dist);
+	plnMat.push_back(mat);
+}
+
+int Scene::findMaterial(const string& name) const
+{
+	for (size_t i = 0; i < matName.size(); i++)
+		if (matName[i] == name)
+			return (int)i;
+	return -1;
+}
+
+void Scene::buildEmitters()
+{
+	emtSph.clear();
+	emtCdf.assign(1, 0.0f);
+	for (int i = 0; i < numSpheres(); i++)
+	{
+		vec3 e = mats[sphMat[i]].emission;
+		float power = (e.x + e.y + e.z)*sphRad[i]*sphRad[i];
+		if (power > 0)
+		{
+			emtSph.push_back(i);
+			emtCdf.push_back(emtCdf.back() + power);
+		}
+	}
+	for (float& c : emtCdf)
+		c /= max(emtCdf.back(), FLT_MIN);
+}
+
+int Scene::sampleEmitter(float u, float& pdf) const
+{
+	if (emtSph.empty())
+	{
+		pdf = 0;
+		return -1;
+	}
+	int i = int(upper_bound(emtCdf.begin() + 1, emtCdf.end(), u) - emtCdf.begin()) - 1;
+	i = min(i, numEmitters() - 1);
+	pdf = emtCdf[i + 1] - emtCdf[i];
+	return emtSph[i];
+}
+
+float Scene::emitterPdf(int sph) const
+{
+	for (int i = 0; i < numEmitters(); i++)
+		if (emtSph[i] == sph)
+			return emtCdf[i + 1] - emtCdf[i];
+	return 0;
+}
+
+int Scene::findEmitter(vec3 pos) const
+{
+	for (int sph : emtSph)
+		if (abs(length(pos - sphPos[sph]) - sphRad[sph]) < 1e-3f*sphRad[sph] + 1e-3f)
+			return sph;
+	return -1;
+}
+
+/**
+ * @brief Reads three floats from the stream into a vec3
+ *
+ */
+static bool readVec3(istream& in, vec3& v)
+{
+	return bool(in >> v.x >> v.y >> v.z);
+}
+
+bool Scene::load(const string& path)
+{
+	ifstream f(path);
+	if (!f)
+	{
+		cout << "ERROR: Could not open scene file " << path << "\n";
+		return false;
+	}
+	string line;
+	int lineNo = 0;
+	while (getline(f, line))
+	{
+		lineNo++;
+		istringstream in(line);
+		string type, name;
+		if (!(in >> type) || type[0] == '#')
+			continue;
+		bool ok = false;
+		if (type == "material")
+		{
+			vec3 albedo, specular, emission;
+			float smoothness;
+			ok = (in >> name) && readVec3(in, albedo) && readVec3(in, specular) && (in >> smoothness) && readVec3(in, emission);
+			if (ok)
+				addMaterial(name, albedo, specular, smoothness, emission);
+		}
+		else if (type == "sphere")
+		{
+			vec3 pos;
+			float rad;
+			ok = readVec3(in, pos) && (in >> rad >> name) && findMaterial(name) >= 0;
+			if (ok)
+				addSphere(pos, rad, findMaterial(name));
+		}
+		else if (type == "triangle")
+		{
+			vec3 vert0, vert1, vert2;
+			ok = readVec3(in, vert0) && readVec3(in, vert1) && readVec3(in, vert2) && (in >> name) && findMaterial(name) >= 0;
+			if (ok)
+				addTriangle(vert0, vert1, vert2, findMaterial(name));
+		}
+		else if (type == "plane")
+		{
+			vec3 norm;
+			float dist;
+			ok = readVec3(in, norm) && (in >> dist >> name) && findMaterial(name) >= 0;
+			if (ok)
+				addPlane(norm, dist, findMaterial(name));
+		}
+		if (!ok)
+		{
+			cout << "ERROR: " << path << ":" << lineNo << ": invalid or unknown " << type << " \"" << line << "\"\n";
+			return false;
+		}
+	}
+	bvh.build(*this);
+	bvh8.build(bvh, *this);
+	buildEmitters();
+	cout << "Loaded scene " << path << ": " << numSpheres() << " spheres, " << numTriangles() << " triangles, "
+		<< numPlanes() << " planes, " << matName.size() << " materials, "
+		<< bvh.nodes.size() << " BVH nodes of depth " << bvh.depth() << ", " << bvh8.nodes.size() << " BVH8 nodes, " << numEmitters() << " emitters\n";
+	return true;
+}
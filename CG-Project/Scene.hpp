@@ -0,0 +1,134 @@
+#pragma once
+
+/**
+ * @file Scene.hpp
+ * @author
+ * @brief Contains the structure-of-arrays scene representation and its loader
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <string>
+#include <vector>
+
+#include "Bvh.hpp"
+#include "Bvh8.hpp"
+#include "MltPixel.hpp"
+
+/**
+ * @brief Struct containing every surface of the scene except the skybox/room.
+ * Each primitive type is stored as parallel arrays so that Trace() can loop over
+ * compact data without constructing objects per ray. Materials are a table indexed
+ * by the hit records, read once per closest hit.
+ *
+ */
+struct Scene
+{
+	/* Materials */
+	std::vector<std::string> matName;
+	std::vector<Material> mats;
+
+	/* Spheres */
+	std::vector<vec3> sphPos;
+	std::vector<float> sphRad;
+	std::vector<int> sphMat;
+
+	/* Triangles, stored as first vertex and the two edges leaving it */
+	std::vector<vec3> tglVert0;
+	std::vector<vec3> tglEdge1;
+	std::vector<vec3> tglEdge2;
+	std::vector<vec3> tglNorm;
+	std::vector<int> tglMat;
+
+	/* Infinite double sided planes dot(norm, p) = dist */
+	std::vector<vec3> plnNorm;
+	std::vector<float> plnDist;
+	std::vector<int> plnMat;
+
+	/* Hierarchy over the spheres and triangles and its 8-wide collapse, rebuilt by load() */
+	Bvh bvh;
+	Bvh8 bvh8;
+
+	/* Spheres with non black emission and the cumulative distribution picking one in
+	 * proportion to its emitted power, rebuilt by load() */
+	std::vector<int> emtSph;
+	std::vector<float> emtCdf;
+
+	int addMaterial(const std::string& name, vec3 albedo, vec3 specular, float smoothness, vec3 emission);
+	void addSphere(vec3 pos, float rad, int mat);
+	void addTriangle(vec3 vert0, vec3 vert1, vec3 vert2, int mat);
+	void addPlane(vec3 norm, float dist, int mat);
+
+	/**
+	 * @brief Returns the index of the material with the given name, or -1
+	 *
+	 */
+	int findMaterial(const std::string& name) const;
+
+	int numSpheres() const
+	{
+		return (int)sphPos.size();
+	}
+
+	int numTriangles() const
+	{
+		return (int)tglVert0.size();
+	}
+
+	int numPlanes() const
+	{
+		return (int)plnNorm.size();
+	}
+
+	int numEmitters() const
+	{
+		return (int)emtSph.size();
+	}
+
+	/**
+	 * @brief Collects the emissive spheres into emtSph and emtCdf
+	 *
+	 */
+	void buildEmitters();
+
+	/**
+	 * @brief Picks an emissive sphere in proportion to its power
+	 *
+	 * @param u Uniform random number in [0, 1)
+	 * @param pdf Returns the probability of picking the sphere
+	 * @return int Index of the sphere, or -1 if the scene has no emitters
+	 */
+	int sampleEmitter(float u, float& pdf) const;
+
+	/**
+	 * @brief Returns the probability of sampleEmitter() picking the given sphere
+	 *
+	 */
+	float emitterPdf(int sph) const;
+
+	/**
+	 * @brief Returns the emissive sphere whose surface contains the given point, or -1
+	 *
+	 */
+	int findEmitter(vec3 pos) const;
+
+	/**
+	 * @brief Reads a scene description file. Every non empty line not starting with # is one of
+	 *
+	 *  material NAME  albedo(r g b)  specular(r g b)  smoothness  emission(r g b)
+	 *  sphere   pos(x y z)  radius  MATERIAL
+	 *  triangle vert0(x y z)  vert1(x y z)  vert2(x y z)  MATERIAL
+	 *  plane    norm(x y z)  dist  MATERIAL
+	 *
+	 * Triangles are single sided, the front face has anticlockwise vertices.
+	 * The BVHs are built once the whole file has been read.
+	 *
+	 * @param path Path of the scene file
+	 * @return true The scene was read
+	 * @return false The file could not be opened or has an invalid line
+	 */
+	bool load(const std::string& path);
+};
@@ -0,0 +1,215 @@
+/**
+ * @file ShadeBatch.cpp
+ * @author
+ * @brief Contains the AVX2/scalar kernels sampling the lobes of a batch of hits
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "BatchMath.hpp"
+#include "FastMath.hpp"
+#include "ShadeBatch.hpp"
+
+using namespace std;
+
+/* The scalar kernels must round exactly like the AVX2 ones, so no fused multiply-adds */
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+void ShadeBatch::reset(int n)
+{
+	for (vector<float>* v : {&axisX, &axisY, &axisZ, &normX, &normY, &normZ, &smoothness, &weightR, &weightG, &weightB,
+		&uCos, &uPhi, &nrgR, &nrgG, &nrgB, &dirX, &dirY, &dirZ})
+		v->resize(n);
+	lobe.resize(n);
+	mat.resize(n);
+	slot.resize(n);
+	order.resize(n);
+	tmpInt.resize(n);
+	tmp.resize(n);
+	size = 0;
+}
+
+void ShadeBatch::push(const LobeSample& s, vec3 norm, vec3 nrg, int material, int caller)
+{
+	int i = size++;
+	lobe[i] = s.lobe;
+	axisX[i] = s.axis.x;
+	axisY[i] = s.axis.y;
+	axisZ[i] = s.axis.z;
+	normX[i] = norm.x;
+	normY[i] = norm.y;
+	normZ[i] = norm.z;
+	smoothness[i] = s.smoothness;
+	weightR[i] = s.weight.x;
+	weightG[i] = s.weight.y;
+	weightB[i] = s.weight.z;
+	uCos[i] = s.uCos;
+	uPhi[i] = s.uPhi;
+	nrgR[i] = nrg.x;
+	nrgG[i] = nrg.y;
+	nrgB[i] = nrg.z;
+	mat[i] = material;
+	slot[i] = caller;
+}
+
+void ShadeBatch::sortByMaterial()
+{
+	/* Counting sort on material and lobe, stable so hits keep their order within a group */
+	int numKeys = 0;
+	for (int i = 0; i < size; i++)
+		numKeys = max(numKeys, 2*mat[i] + lobe[i] + 1);
+	/* Keeps its capacity, so it only allocates when a batch has more materials than the ones before */
+	start.assign(numKeys + 1, 0);
+	for (int i = 0; i < size; i++)
+		start[2*mat[i] + lobe[i] + 1]++;
+	for (int k = 0; k < numKeys; k++)
+		start[k + 1] += start[k];
+	for (int i = 0; i < size; i++)
+		order[start[2*mat[i] + lobe[i]]++] = i;
+
+	for (vector<float>* v : {&axisX, &axisY, &axisZ, &normX, &normY, &normZ, &smoothness, &weightR, &weightG, &weightB,
+		&uCos, &uPhi, &nrgR, &nrgG, &nrgB})
+	{
+		for (int i = 0; i < size; i++)
+			tmp[i] = (*v)[order[i]];
+		copy(tmp.begin(), tmp.begin() + size, v->begin());
+	}
+	for (vector<int>* v : {&lobe, &mat, &slot})
+	{
+		for (int i = 0; i < size; i++)
+			tmpInt[i] = (*v)[order[i]];
+		copy(tmpInt.begin(), tmpInt.begin() + size, v->begin());
+	}
+}
+
+/**
+ * @brief Returns the Phong exponent hit i of the batch samples its lobe with
+ *
+ */
+static float lobeAlpha(const ShadeBatch& b, int i)
+{
+	float s = b.smoothness[i];
+	return b.lobe[i] == LOBE_SPECULAR ? approxExp2(s*s*LOG2_1000) : 1.0f;
+}
+
+/**
+ * @brief Samples the direction of hit i of the batch around the z axis
+ *
+ */
+static void sampleLocalScalar(ShadeBatch& b, int i)
+{
+	float alpha = lobeAlpha(b, i);
+	float u = b.uCos[i];
+	float cosT = u > 0 ? approxExp2(approxLog2(u)/(alpha + 1.0f)) : 0.0f;
+	float sinT = sqrtf(max(0.0f, 1.0f - cosT*cosT));
+	float sinP, cosP;
+	approxSinCos2Pi(b.uPhi[i], sinP, cosP);
+	b.dirX[i] = cosP*sinT;
+	b.dirY[i] = sinP*sinT;
+	b.dirZ[i] = cosT;
+}
+
+/**
+ * @brief Updates the throughput of hit i of the batch once its direction is sampled
+ *
+ */
+static void scaleThroughputScalar(ShadeBatch& b, int i)
+{
+	float scale = 1.0f;
+	if (b.lobe[i] == LOBE_SPECULAR)
+	{
+		float alpha = lobeAlpha(b, i);
+		float f = (alpha + 2.0f)/(alpha + 1.0f);
+		scale = min(max((b.normX[i]*b.dirX[i] + b.normY[i]*b.dirY[i] + b.normZ[i]*b.dirZ[i])*f, 0.0f), 1.0f);
+	}
+	b.nrgR[i] = b.nrgR[i]*(b.weightR[i]*scale);
+	b.nrgG[i] = b.nrgG[i]*(b.weightG[i]*scale);
+	b.nrgB[i] = b.nrgB[i]*(b.weightB[i]*scale);
+}
+
+#ifdef __AVX2__
+
+/**
+ * @brief Samples the lobes of the hits [i, i + 8) of the batch. The operands of min and
+ * max are ordered like std::min() and std::max() so that signed zeros come out the same.
+ *
+ */
+static void sampleLobesAVX2(ShadeBatch& b, int i)
+{
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+	__m256 spec = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)&b.lobe[i]), _mm256_set1_epi32(LOBE_SPECULAR)));
+	__m256 s = _mm256_loadu_ps(&b.smoothness[i]);
+	__m256 alpha = _mm256_blendv_ps(one, approxExp2(_mm256_mul_ps(_mm256_mul_ps(s, s), _mm256_set1_ps(LOG2_1000))), spec);
+	__m256 u = _mm256_loadu_ps(&b.uCos[i]);
+	__m256 positive = _mm256_cmp_ps(u, zero, _CMP_GT_OQ);
+	/* Zeros go through log2() as 1 and are masked afterwards */
+	__m256 cosT = approxExp2(_mm256_div_ps(approxLog2(_mm256_blendv_ps(one, u, positive)), _mm256_add_ps(alpha, one)));
+	cosT = _mm256_and_ps(cosT, positive);
+	__m256 sinT = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(one, _mm256_mul_ps(cosT, cosT)), zero));
+	__m256 sinP, cosP;
+	approxSinCos2Pi(_mm256_loadu_ps(&b.uPhi[i]), sinP, cosP);
+	__m256 lx = _mm256_mul_ps(cosP, sinT), ly = _mm256_mul_ps(sinP, sinT), lz = cosT;
+
+	__m256 ax = _mm256_loadu_ps(&b.axisX[i]), ay = _mm256_loadu_ps(&b.axisY[i]), az = _mm256_loadu_ps(&b.axisZ[i]);
+	__m256 absX = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), ax);
+	__m256 nearX = _mm256_cmp_ps(absX, _mm256_set1_ps(0.99f), _CMP_GT_OQ);
+	__m256 hx = _mm256_blendv_ps(one, zero, nearX), hz = _mm256_blendv_ps(zero, one, nearX);
+	__m256 tx = _mm256_mul_ps(ay, hz);
+	__m256 ty = _mm256_sub_ps(_mm256_mul_ps(az, hx), _mm256_mul_ps(ax, hz));
+	__m256 tz = _mm256_xor_ps(_mm256_mul_ps(ay, hx), _mm256_set1_ps(-0.0f));
+	__m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, tx), _mm256_mul_ps(ty, ty)), _mm256_mul_ps(tz, tz))));
+	tx = _mm256_mul_ps(tx, inv);
+	ty = _mm256_mul_ps(ty, inv);
+	tz = _mm256_mul_ps(tz, inv);
+	__m256 bx = _mm256_sub_ps(_mm256_mul_ps(ay, tz), _mm256_mul_ps(az, ty));
+	__m256 by = _mm256_sub_ps(_mm256_mul_ps(az, tx), _mm256_mul_ps(ax, tz));
+	__m256 bz = _mm256_sub_ps(_mm256_mul_ps(ax, ty), _mm256_mul_ps(ay, tx));
+	inv = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(bx, bx), _mm256_mul_ps(by, by)), _mm256_mul_ps(bz, bz))));
+	bx = _mm256_mul_ps(bx, inv);
+	by = _mm256_mul_ps(by, inv);
+	bz = _mm256_mul_ps(bz, inv);
+	__m256 dx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, lx), _mm256_mul_ps(bx, ly)), _mm256_mul_ps(ax, lz));
+	__m256 dy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ty, lx), _mm256_mul_ps(by, ly)), _mm256_mul_ps(ay, lz));
+	__m256 dz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tz, lx), _mm256_mul_ps(bz, ly)), _mm256_mul_ps(az, lz));
+	_mm256_storeu_ps(&b.dirX[i], dx);
+	_mm256_storeu_ps(&b.dirY[i], dy);
+	_mm256_storeu_ps(&b.dirZ[i], dz);
+
+	__m256 f = _mm256_div_ps(_mm256_add_ps(alpha, _mm256_set1_ps(2.0f)), _mm256_add_ps(alpha, one));
+	__m256 cosN = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&b.normX[i]), dx), _mm256_mul_ps(_mm256_loadu_ps(&b.normY[i]), dy)),
+		_mm256_mul_ps(_mm256_loadu_ps(&b.normZ[i]), dz));
+	__m256 scale = _mm256_min_ps(one, _mm256_max_ps(zero, _mm256_mul_ps(cosN, f)));
+	scale = _mm256_blendv_ps(one, scale, spec);
+	_mm256_storeu_ps(&b.nrgR[i], _mm256_mul_ps(_mm256_loadu_ps(&b.nrgR[i]), _mm256_mul_ps(_mm256_loadu_ps(&b.weightR[i]), scale)));
+	_mm256_storeu_ps(&b.nrgG[i], _mm256_mul_ps(_mm256_loadu_ps(&b.nrgG[i]), _mm256_mul_ps(_mm256_loadu_ps(&b.weightG[i]), scale)));
+	_mm256_storeu_ps(&b.nrgB[i], _mm256_mul_ps(_mm256_loadu_ps(&b.nrgB[i]), _mm256_mul_ps(_mm256_loadu_ps(&b.weightB[i]), scale)));
+}
+
+#endif
+
+void SampleLobes(ShadeBatch& batch)
+{
+	int i = 0;
+#ifdef __AVX2__
+	for (; i + 8 <= batch.size; i += 8)
+		sampleLobesAVX2(batch, i);
+#endif
+	/* The rest in three passes, so that the tangent spaces run on the widest instruction set of the CPU */
+	for (int k = i; k < batch.size; k++)
+		sampleLocalScalar(batch, k);
+	Vec3Stream axis = {batch.axisX.data(), batch.axisY.data(), batch.axisZ.data()};
+	Vec3Stream dir = {batch.dirX.data(), batch.dirY.data(), batch.dirZ.data()};
+	BatchTgnToWorld(axis.from(i), dir.from(i), dir.from(i), batch.size - i);
+	for (int k = i; k < batch.size; k++)
+		scaleThroughputScalar(batch, k);
+}
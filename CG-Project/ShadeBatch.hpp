@@ -0,0 +1,78 @@
+#pragma once
+
+/**
+ * @file ShadeBatch.hpp
+ * @author
+ * @brief Contains the batches of hits which sample their scattered directions together
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <vector>
+
+#include "MltPixel.hpp"
+
+/**
+ * @brief Struct for the lobe samples of many hits, one array per component. After
+ * sortByMaterial() hits of the same material and lobe lie next to each other, so the
+ * lanes of a SampleLobes() step mostly share their smoothness and branch.
+ *
+ */
+struct ShadeBatch
+{
+	/* Inputs, see LobeSample */
+	std::vector<int> lobe;
+	std::vector<float> axisX, axisY, axisZ;
+	std::vector<float> normX, normY, normZ;
+	std::vector<float> smoothness;
+	std::vector<float> weightR, weightG, weightB;
+	std::vector<float> uCos, uPhi;
+	/* Throughput, multiplied in place */
+	std::vector<float> nrgR, nrgG, nrgB;
+	/* Sampled directions */
+	std::vector<float> dirX, dirY, dirZ;
+	/* Material index, and the caller's index of every hit */
+	std::vector<int> mat;
+	std::vector<int> slot;
+	int size = 0;
+	/* Scratch space of sortByMaterial(), kept between batches so sorting does not allocate */
+	std::vector<int> start, order, tmpInt;
+	std::vector<float> tmp;
+
+	/**
+	 * @brief Empties the batch and makes room for n hits
+	 *
+	 */
+	void reset(int n);
+
+	/**
+	 * @brief Queues a hit
+	 *
+	 * @param s Lobe picked by ShadeLobe()
+	 * @param norm Normal of the hit
+	 * @param nrg Throughput of the ray before the hit
+	 * @param material Index of the hit's material
+	 * @param caller Index the caller finds the result by
+	 */
+	void push(const LobeSample& s, vec3 norm, vec3 nrg, int material, int caller);
+
+	/**
+	 * @brief Reorders the hits by material, and the hits of a material by lobe
+	 *
+	 */
+	void sortByMaterial();
+};
+
+/**
+ * @brief Samples the direction of every hit of the batch in its lobe and updates its
+ * throughput, like ShadeDeferred() does after ShadeLobe(). The AVX2 build runs eight
+ * hits at a time, the scalar build rounds exactly the same and turns the directions into
+ * world space with BatchTgnToWorld(). pow(), cos() and sin() are
+ * replaced by the polynomials of FastMath.hpp, so directions differ from SampleHemi()
+ * in the last bits.
+ *
+ */
+void SampleLobes(ShadeBatch& batch);
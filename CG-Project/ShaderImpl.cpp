@@ -10,12 +10,62 @@
  */
 
 #include <algorithm>
+#include <cfloat>
 #include <iostream>
 
+#include "AccumFilm.hpp"
+#include "FastMath.hpp"
 #include "MltPixel.hpp"
+#include "Scene.hpp"
 
 using namespace std;
 
+/**
+ * @brief Scene traced by Trace(), set once before rendering
+ * 
+ */
+static const Scene* scene = nullptr;
+
+/**
+ * @brief Integrator parameters used by every render, set with setConfig()
+ * 
+ */
+static RenderConfig config;
+
+/**
+ * @brief Material of the skybox/room, and of rays which did not hit anything
+ * 
+ */
+static const Material skyMaterial = {vec3(0.1f), vec3(0.1f), vec3(0.0f), 0.0f};
+static const Material noMaterial = {vec3(0.0f), vec3(0.0f), vec3(0.0f), 0.0f};
+
+/**
+ * @brief Normals of the faces of the skybox/room, the last one for rays missing every face
+ * 
+ */
+static const vec3 roomNorms[7] = {vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, 1, 0), vec3(-1, 0, 0), vec3(1, 0, 0), vec3(0)};
+
+void setScene(const Scene* scn)
+{
+	scene = scn;
+}
+
+bool setConfig(const RenderConfig& cfg)
+{
+	if (cfg.maxHits < 1 || cfg.maxHits > MAX_HITS || cfg.minHits < 0 || cfg.samples < 1 || cfg.mutations < 0)
+	{
+		cout << "ERROR: Invalid render configuration, paths need 1 to " << MAX_HITS << " bounces and at least one sample\n";
+		return false;
+	}
+	config = cfg;
+	return true;
+}
+
+const RenderConfig& getConfig()
+{
+	return config;
+}
+
 /**
  * @brief Initializes a RayHit object
  * 
@@ -25,27 +75,38 @@ RayHit CreateRayHit()
 {
 	RayHit hit;
 	hit.dist = -1;
-	hit.smoothness = 0.0f;
 	hit.skybox = false;
-	hit.albedo = vec3(0.0f, 0.0f, 0.0f);
-	hit.emission = vec3(0, 0, 0);
 	hit.norm = vec3(0.0f, 0.0f, 0.0f);
 	hit.pos = vec3(0.0f, 0.0f, 0.0f);
-	hit.specular = vec3(0.0f, 0.0f, 0.0f);
+	hit.mat = &noMaterial;
 	return hit;
 }
 
 /**
- * @brief Generates a random float from [0, 1] based on the
- * uniform distribution
+ * @brief Initializes a HitRecord object
  * 
- * @param e2 Random number generator engine
- * @param dist Uniform Distribution object
+ * @return HitRecord object initialized
+ */
+HitRecord CreateHitRecord()
+{
+	HitRecord rec;
+	rec.t = -1;
+	rec.prim = 0;
+	rec.mat = -1;
+	rec.bary = vec2(0.0f);
+	return rec;
+}
+
+/**
+ * @brief Generates a random float from [0, 1) from the next dimension of the
+ * pixel's counter-based generator
+ * 
+ * @param rng Random number generator of the current sample
  * @return float Random float between 0 and 1
  */
-float randfloat(mt19937& e2, uniform_real_distribution<float>& dist)
+float randfloat(Rng& rng)
 {
-	return dist(e2);
+	return rng.next();
 }
 
 /**
@@ -81,7 +142,11 @@ float nrg(vec3 colour)
  */
 float SmoothnessToPhongAlpha(float s)
 {
+#if FAST_SAMPLING
+	return approxExp2(s*s*LOG2_1000);
+#else
 	return pow(1000.0, s*s);
+#endif
 }
 
 /**
@@ -106,36 +171,124 @@ mat3 GetTgnSpace(vec3 norm)
  * 
  * @param norm Perfectly Reflected Ray off the hemisphere surface
  * @param alpha Alpha
- * @param e2 Random Number Generator
- * @param dist Uniform Distribution
+ * @param rng Random Number Generator
  * @return vec3 Sampled Reflected Ray
  */
-vec3 SampleHemi(vec3 norm, float alpha, mt19937& e2, uniform_real_distribution<float>& dist)
+vec3 SampleHemi(vec3 norm, float alpha, Rng& rng)
+{
+	float uCos = randfloat(rng);
+	return SampleHemi(norm, alpha, uCos, randfloat(rng));
+}
+
+vec3 SampleHemi(vec3 norm, float alpha, float uCos, float uPhi)
 {
-	float cosTheta = pow(randfloat(e2, dist), 1.0/(alpha + 1.0));
+#if FAST_SAMPLING
+	float cosTheta = approxPow(uCos, 1.0f/(alpha + 1.0f));
+	float sinTheta = sqrt(max(0.0f, 1.0f - cosTheta*cosTheta));
+	float sinPhi, cosPhi;
+	approxSinCos2Pi(uPhi, sinPhi, cosPhi);
+	vec3 tgnSpaceDir = vec3(cosPhi*sinTheta, sinPhi*sinTheta, cosTheta);
+#else
+	float cosTheta = pow(uCos, 1.0/(alpha + 1.0));
 	float sinTheta = sqrt(max(0.0, 1.0 - cosTheta*cosTheta));
-	float phi = 2*3.141593*randfloat(e2, dist);
+	float phi = 2*3.141593*uPhi;
 	vec3 tgnSpaceDir = vec3(cos(phi)*sinTheta, sin(phi)*sinTheta, cosTheta);
+#endif
 	return GetTgnSpace(norm)*tgnSpaceDir;
 }
 
+/**
+ * @brief Returns the probabilities with which Shade() picks the specular and the diffuse lobe
+ * 
+ * @param hit RayHit whose material is used
+ * @param albedo Returns the diffuse albedo after energy conservation against the specular colour
+ * @param specProb Returns the probability of the specular lobe
+ * @param diffProb Returns the probability of the diffuse lobe
+ */
+void LobeProbs(const RayHit& hit, vec3& albedo, float& specProb, float& diffProb)
+{
+	const Material& m = *hit.mat;
+	albedo = min(1.0f - m.specular, m.albedo);
+	specProb = nrg(m.specular);
+	diffProb = nrg(albedo);
+	float sum = specProb + diffProb;
+	specProb = sum > 0 ? specProb/sum : 0.0f;
+	diffProb = sum > 0 ? diffProb/sum : 0.0f;
+}
+
+/**
+ * @brief Evaluates the BSDF sampled by Shade(): a Lambertian lobe plus a normalized Phong
+ * lobe around the mirror direction
+ * 
+ * @param hit RayHit whose material is evaluated
+ * @param wi Unit direction from the hit towards where the light leaves to
+ * @param wo Unit direction from the hit towards where the light arrives from
+ * @return vec3 BSDF value, without the cosine term
+ */
+vec3 EvalBsdf(const RayHit& hit, vec3 wi, vec3 wo)
+{
+	if (dot(hit.norm, wi) <= 0 || dot(hit.norm, wo) <= 0)
+		return vec3(0.0f);
+	const Material& m = *hit.mat;
+	vec3 albedo = min(1.0f - m.specular, m.albedo);
+	float alpha = SmoothnessToPhongAlpha(m.smoothness);
+	float cosR = max(0.0f, dot(reflect(-wi, hit.norm), wo));
+	return albedo*(1.0f/3.141593f) + m.specular*((alpha + 2)/(2*3.141593f)*pow(cosR, alpha));
+}
+
+/**
+ * @brief Returns the solid angle density with which Shade() samples wo after arriving from wi
+ * 
+ * @param hit RayHit whose material is sampled
+ * @param wi Unit direction from the hit back along the arriving ray
+ * @param wo Unit direction of the sampled ray
+ * @return float Density of wo
+ */
+float PdfBsdf(const RayHit& hit, vec3 wi, vec3 wo)
+{
+	vec3 albedo;
+	float specProb, diffProb;
+	LobeProbs(hit, albedo, specProb, diffProb);
+	float alpha = SmoothnessToPhongAlpha(hit.mat->smoothness);
+	float cosR = max(0.0f, dot(reflect(-wi, hit.norm), wo));
+	float cosN = max(0.0f, dot(hit.norm, wo));
+	return specProb*(alpha + 1)/(2*3.141593f)*pow(cosR, alpha) + diffProb*cosN/3.141593f;
+}
+
+/**
+ * @brief Samples a scattered direction the same way as Shade()
+ * 
+ * @param hit RayHit whose material is sampled
+ * @param wi Unit direction from the hit back along the arriving ray
+ * @param rng Random Number Generator
+ * @return vec3 Sampled direction
+ */
+vec3 SampleBsdf(const RayHit& hit, vec3 wi, Rng& rng)
+{
+	vec3 albedo;
+	float specProb, diffProb;
+	LobeProbs(hit, albedo, specProb, diffProb);
+	if (randfloat(rng) < specProb)
+		return SampleHemi(reflect(-wi, hit.norm), SmoothnessToPhongAlpha(hit.mat->smoothness), rng);
+	return SampleHemi(hit.norm, 1.0f, rng);
+}
+
 /**
  * @brief Tests the given ray's intersection with the given triangle
  * 
  * @param ray Ray to test intersection with
  * @param vert0 First Vertex of the Triangle in AntiClockWise Order
- * @param vert1 Second Vertex of the Triangle in AntiClockWise Order
- * @param vert2 Third Vertex of the Triangle in AntiClockWise Order
- * @param t Barycentric Coordinate 1 of the Triangle in case of intersection
- * @param u Barycentric Coordinate 2 of the Triangle in case of intersection
- * @param v Barycentric Coordinate 3 of the Triangle in case of intersection
+ * @param edge1 Edge from the first to the second Vertex
+ * @param edge2 Edge from the first to the third Vertex
+ * @param t Distance along the ray in case of intersection
+ * @param u Barycentric Coordinate 1 of the Triangle in case of intersection
+ * @param v Barycentric Coordinate 2 of the Triangle in case of intersection
  * @return true Triangle intersects the ray and the intersection can be computed based on the
  * Barycentric coordinates
  * @return false Triangle does not intersect the ray
  */
-bool intersectTgl_MT97(Ray ray, vec3 vert0, vec3 vert1, vec3 vert2, float& t, float& u, float& v)
+bool intersectTglEdges_MT97(const Ray& ray, vec3 vert0, vec3 edge1, vec3 edge2, float& t, float& u, float& v)
 {
-	vec3 edge1 = vert1 - vert0, edge2 = vert2 - vert0;
 	vec3 pvec = cross(ray.dir, edge2);
 	float det = dot(edge1, pvec);
 	if (det < 0.001)
@@ -153,17 +306,37 @@ bool intersectTgl_MT97(Ray ray, vec3 vert0, vec3 vert1, vec3 vert2, float& t, fl
 	return true;
 }
 
+/**
+ * @brief Tests the given ray's intersection with the given triangle
+ * 
+ * @param ray Ray to test intersection with
+ * @param vert0 First Vertex of the Triangle in AntiClockWise Order
+ * @param vert1 Second Vertex of the Triangle in AntiClockWise Order
+ * @param vert2 Third Vertex of the Triangle in AntiClockWise Order
+ * @param t Distance along the ray in case of intersection
+ * @param u Barycentric Coordinate 1 of the Triangle in case of intersection
+ * @param v Barycentric Coordinate 2 of the Triangle in case of intersection
+ * @return true Triangle intersects the ray and the intersection can be computed based on the
+ * Barycentric coordinates
+ * @return false Triangle does not intersect the ray
+ */
+bool intersectTgl_MT97(Ray ray, vec3 vert0, vec3 vert1, vec3 vert2, float& t, float& u, float& v)
+{
+	return intersectTglEdges_MT97(ray, vert0, vert1 - vert0, vert2 - vert0, t, u, v);
+}
+
 /**
  * @brief Tests ray intersection with the skybox/room at Infinity
  * 
  * @param ray Ray to intersect with
- * @param bestHit Returns the RayHit of the hit skybox if the skybox is visible to the ray
+ * @param bestHit Returns the record of the hit face if the skybox is visible to the ray
  */
-void intersectRoom(Ray ray, RayHit& bestHit)
+void intersectRoom(Ray ray, HitRecord& bestHit)
 {
 	float halfLen = 10000, nearestDist = 10000000.0, denom;
 	bool testBack = true, testDown = true, testLeft = true;
-	vec3 nearest, norm = vec3(0), pPt, pNorm;
+	vec3 nearest, pPt, pNorm;
+	int face = 6;
 
 	/* Front face */
 	pPt = vec3(0.0, 0.0, -halfLen), pNorm = vec3(0.0, 0.0, 1.0);
@@ -176,7 +349,7 @@ void intersectRoom(Ray ray, RayHit& bestHit)
 			testDown = false;
 			nearest = ray.org + t*ray.dir;
 			nearestDist = t;
-			norm = pNorm;
+			face = 0;
 		}
 	}
 	else testBack = false;
@@ -196,7 +369,7 @@ void intersectRoom(Ray ray, RayHit& bestHit)
 				{
 					nearest = ray.org + t*ray.dir;
 					nearestDist = dist;
-					norm = pNorm;
+					face = 1;
 				}
 			}
 		}
@@ -216,7 +389,7 @@ void intersectRoom(Ray ray, RayHit& bestHit)
 			{
 				nearest = ray.org + t*ray.dir;
 				nearestDist = dist;
-				norm = pNorm;
+				face = 2;
 			}
 		}
 	}
@@ -237,7 +410,7 @@ void intersectRoom(Ray ray, RayHit& bestHit)
 				{
 					nearest = ray.org + t*ray.dir;
 					nearestDist = dist;
-					norm = pNorm;
+					face = 3;
 				}
 			}
 		}
@@ -257,7 +430,7 @@ void intersectRoom(Ray ray, RayHit& bestHit)
 			{
 				nearest = ray.org + t*ray.dir;
 				nearestDist = dist;
-				norm = pNorm;
+				face = 4;
 			}
 		}
 	}
@@ -278,399 +451,547 @@ void intersectRoom(Ray ray, RayHit& bestHit)
 				{
 					nearest = ray.org + t*ray.dir;
 					nearestDist = dist;
-					norm = pNorm;
+					face = 5;
 				}
 			}
 		}
 	}
 
-	if (nearestDist < bestHit.dist || bestHit.dist == -1)
+	if (nearestDist < bestHit.t || bestHit.t == -1)
 	{
-		bestHit.dist = nearestDist;
-		bestHit.smoothness = 0.0;
-		bestHit.skybox = true;
-		bestHit.albedo = vec3(0.1);
-		bestHit.emission = vec3(0.0);
-		bestHit.norm = norm;
-		bestHit.pos = ray.org + nearestDist*ray.dir;
-		bestHit.specular = vec3(0.1);
+		bestHit.t = nearestDist;
+		bestHit.prim = face | HIT_SKYBOX;
+		bestHit.mat = -1;
 	}
 }
 
 /**
- * @brief Tests the intersection of the ray with the Ground and updates the bestHit
- * in case the ground plane is visible to the ray
+ * @brief Tests the intersection of the ray with the infinite planes of the scene
+ * (e.g. the Ground) and updates the bestHit in case a plane is visible to the ray
  * 
  * @param ray Ray to test intersection with
- * @param bestHit RayHit to change after finding that the ground plane is visible
+ * @param bestHit RayHit to change after finding that a plane is visible
  */
-void intersectGroundPlane(Ray ray, RayHit& bestHit)
+void intersectPlanes(const Ray& ray, HitRecord& bestHit)
 {
-	float t = (-ray.org.y - 17.0f)/ray.dir.y;
-	if (t > 0.1f && (t < bestHit.dist || bestHit.dist == -1))
+	for (int i = 0; i < scene->numPlanes(); i++)
 	{
-		bestHit.dist = t;
-		bestHit.pos = ray.org + t*ray.dir;
-		bestHit.norm = vec3(0.0, 1.0, 0.0);
-		bestHit.albedo = vec3(1.0);
-		bestHit.specular = vec3(1.0);
-		bestHit.emission = vec3(0.0);
-		bestHit.smoothness = 1;
-		bestHit.skybox = false;
+		vec3 norm = scene->plnNorm[i];
+		float t = (scene->plnDist[i] - dot(norm, ray.org))/dot(norm, ray.dir);
+		if (t > 0.1f && (t < bestHit.t || bestHit.t == -1))
+		{
+			bestHit.t = t;
+			bestHit.prim = i | HIT_PLANE;
+			bestHit.mat = scene->plnMat[i];
+		}
 	}
 }
 
-/* */
 /**
- * @brief  Testing the intersection of a ray and a sphere and modifying the 
+ * @brief  Testing the intersection of a ray and a sphere of the scene and modifying the 
  * previous best hit if the sphere is visible to that ray
  * @param ray Ray to test intersection with
  * @param bestHit bestHit to modify in case of visibility
- * @param sph Sphere to test intersection and visibility with
+ * @param i Index of the sphere in the scene
  */
-void intersectSph(Ray ray, RayHit& bestHit, Sph sph)
+void intersectSph(const Ray& ray, HitRecord& bestHit, int i)
 {
-	vec3 d = ray.org - sph.pos;
-	float p1 = -dot(ray.dir, d), p2sqr = p1*p1 - dot(d, d) + sph.rad*sph.rad;
+	vec3 d = ray.org - scene->sphPos[i];
+	float rad = scene->sphRad[i];
+	float p1 = -dot(ray.dir, d), p2sqr = p1*p1 - dot(d, d) + rad*rad;
 	if (p2sqr < 0)
 		return;
 	float p2 = sqrt(p2sqr);
 	float t = (p1 - p2) > 0 ? (p1 - p2) : (p1 + p2);
-	if (t > 0.1 && (t < bestHit.dist || bestHit.dist == -1))
+	if (t > 0.1 && (t < bestHit.t || bestHit.t == -1))
 	{
-		bestHit.dist = t;
-		bestHit.pos = ray.org + t*ray.dir;
-		bestHit.norm = normalize(bestHit.pos - sph.pos);
-		bestHit.albedo = sph.albedo;
-		bestHit.specular = sph.specular;
-		bestHit.emission = sph.emission;
-		bestHit.smoothness = sph.smoothness;
-		bestHit.skybox = false;
+		bestHit.t = t;
+		bestHit.prim = i | HIT_SPHERE;
+		bestHit.mat = scene->sphMat[i];
 	}
 }
 
 /**
- * @brief Goes through all the objects in the scene and bounces the
- * given ray off the closest object visible to it.
+ * @brief Walks the 8-wide scene BVH. All child boxes of a node are slab tested at once, hit
+ * children are pushed far to near and popped entries behind the closest hit so far are
+ * skipped. Leaves test their triangles 8 at a time and their spheres one by one.
  * 
- * @param ray Ray to bounce off
- * @return RayHit Point at which the ray has bounced off
+ * @param ray Ray to test intersection with
+ * @param bestHit bestHit to modify in case of visibility
+ * @param twoSided Also hit triangles from behind
  */
-RayHit Trace(Ray ray)
+void intersectBvh8(const Ray& ray, HitRecord& bestHit, bool twoSided)
 {
-	RayHit bestHit = CreateRayHit();
-	intersectRoom(ray, bestHit);
-	intersectGroundPlane(ray, bestHit);
-	intersectSph(ray, bestHit, Sph(vec3(-15.0f, -12.6, -30.0f), 4.0, vec3(0.0), vec3(1.0, 1.0f, 1.0f), 1.2, vec3(0.0)));
-	intersectSph(ray, bestHit, Sph(vec3(-3.0f, -9.6, -75.0f), 7.0, vec3(0.0, 0.0, 0.0), vec3(1.0, 0.35, 0.45), 0.1, vec3(0.0)));
-	intersectSph(ray, bestHit, Sph(vec3(1.0f, -14.6, -62.0f), 2.0, vec3(0.0, 0.0, 0.0), vec3(1.0, 1.0, 1.0), 0.0, vec3(0.0)));
-	intersectSph(ray, bestHit, Sph(vec3(17.0f, -7.0, -45.0f), 3.0, vec3(1.0), vec3(0.1), 0.8, vec3(0.0, 10.0, 10.0)));
-
-	vec3 wallEmission = vec3(0);
-	vec3 wallSpecular = vec3(0.1);
-	vec3 wallAlbedo = vec3(1);
-	float wallSmoothness = 1;
-
-	vec3 v0 = vec3(-40.0, -17.0, -65.0);
-	vec3 v1 = vec3(15.0, -17.0, -65.0);
-	vec3 v2 = vec3(-40.0, 6.0, -65.0);
-	float t, u, v;
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
+	const Bvh8& bvh = scene->bvh8;
+	if (bvh.nodes.empty())
+		return;
+	vec3 invDir = 1.0f/ray.dir;
+	int stack[BVH8_STACK_SIZE], sp = 0;
+	float stackT[BVH8_STACK_SIZE], tEnter[BVH8_WIDTH];
+	stack[sp] = 0;
+	stackT[sp++] = 0.0f;
+	while (sp > 0)
 	{
-		if (t > 0 && t < bestHit.dist)
+		sp--;
+		int child = stack[sp];
+		if (stackT[sp] > bestHit.t)
+			continue;
+		if (child >= 0)
 		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
+			const Bvh8Node& node = bvh.nodes[child];
+			int mask = intersectBvh8Node(ray.org, invDir, node, bestHit.t, tEnter);
+			/* Insert the hit children so that the nearest ends up on top */
+			int base = sp;
+			for (int i = 0; mask; i++, mask >>= 1)
+			{
+				if (!(mask & 1))
+					continue;
+				int j = sp++;
+				while (j > base && stackT[j - 1] < tEnter[i])
+				{
+					stack[j] = stack[j - 1];
+					stackT[j] = stackT[j - 1];
+					j--;
+				}
+				stack[j] = node.child[i];
+				stackT[j] = tEnter[i];
+			}
+			continue;
 		}
-	}
-
-	v0 = vec3(-40.0, 6.0, -65.0);
-	v1 = vec3(15.0, -17.0, -65.0);
-	v2 = vec3(15.0, 6.0, -65.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
-	{
-		if (t > 0 && t < bestHit.dist)
+		const Bvh8Leaf& leaf = bvh.leaves[~child];
+		for (int i = leaf.firstPacket; i < leaf.firstPacket + leaf.numPackets; i++)
 		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
+			float t;
+			int lane = intersectTglPacket(ray.org, ray.dir, bvh.packets[i], bestHit.t, t, twoSided);
+			if (lane >= 0)
+			{
+				int tgl = bvh.packets[i].id[lane];
+				bestHit.t = t;
+				bestHit.prim = tgl;
+				bestHit.mat = scene->tglMat[tgl];
+			}
 		}
+		for (int i = leaf.firstSph; i < leaf.firstSph + leaf.numSph; i++)
+			intersectSph(ray, bestHit, bvh.sphs[i]);
 	}
+}
 
-	v0 = vec3(-30.0, 6.0, -65.0);
-	v1 = vec3(-25.0, 6.0, 35.0);
-	v2 = vec3(-25.0, -17.0, 35.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
+/**
+ * @brief Any-hit version of intersectPlanes() and intersectBvh8(): returns as soon as
+ * something is found closer than maxDist, without ordering the children of a node.
+ * 
+ * @param ray Ray to test
+ * @param maxDist Distance up to which the ray has to be unblocked
+ * @param twoSided Triangles block the ray from behind as well
+ * @return true The ray hits a surface closer than maxDist
+ * @return false Nothing is in the way
+ */
+bool Occluded(const Ray& ray, float maxDist, bool twoSided)
+{
+	for (int i = 0; i < scene->numPlanes(); i++)
 	{
-		if (t > 0 && t < bestHit.dist)
-		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
-		}
+		vec3 norm = scene->plnNorm[i];
+		float t = (scene->plnDist[i] - dot(norm, ray.org))/dot(norm, ray.dir);
+		if (t > 0.1f && t < maxDist)
+			return true;
 	}
 
-	v0 = vec3(-30, 6, -65.0);
-	v1 = vec3(-25, -17, 35.0);
-	v2 = vec3(-30, -17, -65.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
+	const Bvh8& bvh = scene->bvh8;
+	if (bvh.nodes.empty())
+		return false;
+	vec3 invDir = 1.0f/ray.dir;
+	int stack[BVH8_STACK_SIZE], sp = 0;
+	float tEnter[BVH8_WIDTH];
+	stack[sp++] = 0;
+	while (sp > 0)
 	{
-		if (t > 0 && t < bestHit.dist)
+		int child = stack[--sp];
+		if (child >= 0)
 		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
+			const Bvh8Node& node = bvh.nodes[child];
+			for (int mask = intersectBvh8Node(ray.org, invDir, node, maxDist, tEnter), i = 0; mask; i++, mask >>= 1)
+				if (mask & 1)
+					stack[sp++] = node.child[i];
+			continue;
 		}
-	}
-
-	v0 = vec3(-25.0, 6.0, 15.0);
-	v1 = vec3(15.0, -17.0, 15.0);
-	v2 = vec3(-25.0, -17.0, 15.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
-	{
-		if (t > 0 && t < bestHit.dist)
+		const Bvh8Leaf& leaf = bvh.leaves[~child];
+		for (int i = leaf.firstPacket; i < leaf.firstPacket + leaf.numPackets; i++)
 		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
+			float t;
+			if (intersectTglPacket(ray.org, ray.dir, bvh.packets[i], maxDist, t, twoSided) >= 0)
+				return true;
 		}
-	}
-
-	v0 = vec3(-25.0, 6.0, 15.0);
-	v1 = vec3(15.0, 6.0, 15.0);
-	v2 = vec3(15.0, -17.0, 15.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
-	{
-		if (t > 0 && t < bestHit.dist)
+		for (int i = leaf.firstSph; i < leaf.firstSph + leaf.numSph; i++)
 		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
+			HitRecord probe = CreateHitRecord();
+			probe.t = maxDist;
+			intersectSph(ray, probe, bvh.sphs[i]);
+			if (probe.t < maxDist)
+				return true;
 		}
 	}
+	return false;
+}
 
-	v0 = vec3(15.0, 6.0, 15.0);
-	v1 = vec3(15.0, 6.0, -35.0);
-	v2 = vec3(15.0, -17.0, -35.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
-	{
-		if (t > 0 && t < bestHit.dist)
-		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
-		}
-	}
+/**
+ * @brief Computes the barycentric coordinates of a final triangle hit, which the
+ * 8-wide triangle tests do not return
+ * 
+ * @param ray Ray which produced the record
+ * @param rec Closest hit of the ray
+ */
+static void completeRecord(const Ray& ray, HitRecord& rec)
+{
+	if (rec.t == -1 || (rec.prim & HIT_KIND_MASK) != HIT_TRIANGLE)
+		return;
+	int i = int(rec.prim);
+	vec3 edge1 = scene->tglEdge1[i], edge2 = scene->tglEdge2[i];
+	vec3 pvec = cross(ray.dir, edge2), tvec = ray.org - scene->tglVert0[i];
+	float invDet = 1.0f/dot(edge1, pvec);
+	rec.bary = vec2(dot(tvec, pvec)*invDet, dot(ray.dir, cross(tvec, edge1))*invDet);
+}
 
-	v0 = vec3(15.0, 6.0, 15.0);
-	v1 = vec3(15.0, -17.0, -35.0);
-	v2 = vec3(15.0, -17.0, 15.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
+RayHit FetchHit(const Ray& ray, const HitRecord& rec)
+{
+	RayHit hit = CreateRayHit();
+	if (rec.t == -1)
+		return hit;
+	hit.dist = rec.t;
+	hit.pos = ray.org + rec.t*ray.dir;
+	uint32_t i = rec.prim & ~HIT_KIND_MASK;
+	switch (rec.prim & HIT_KIND_MASK)
 	{
-		if (t > 0 && t < bestHit.dist)
-		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
-		}
+	case HIT_TRIANGLE:
+		hit.norm = scene->tglNorm[i];
+		break;
+	case HIT_SPHERE:
+		hit.norm = normalize(hit.pos - scene->sphPos[i]);
+		break;
+	case HIT_PLANE:
+		hit.norm = scene->plnNorm[i];
+		break;
+	default:
+		hit.norm = roomNorms[i];
+		hit.skybox = true;
+		hit.mat = &skyMaterial;
+		return hit;
 	}
+	hit.mat = &scene->mats[rec.mat];
+	return hit;
+}
 
-	v0 = vec3(15.0, 6.0, -65.0);
-	v1 = vec3(11.0, -17.0, -30.0);
-	v2 = vec3(15.0, -17.0, -65.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
-	{
-		if (t > 0 && t < bestHit.dist)
-		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
-		}
-	}
+/**
+ * @brief Goes through all the objects in the scene and finds the closest
+ * one visible to the given ray.
+ * 
+ * @param ray Ray to trace
+ * @param twoSided Also hit triangles from behind
+ * @return HitRecord Record of the closest hit
+ */
+HitRecord TraceRecord(const Ray& ray, bool twoSided)
+{
+	HitRecord bestHit = CreateHitRecord();
+	intersectRoom(ray, bestHit);
+	intersectPlanes(ray, bestHit);
+	intersectBvh8(ray, bestHit, twoSided);
+	completeRecord(ray, bestHit);
+	return bestHit;
+}
 
-	v2 = vec3(15.0, 6.0, -65.0);
-	v1 = vec3(11.0, -17.0, -30.0);
-	v0 = vec3(15.0, -17.0, -65.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
-	{
-		if (t > 0 && t < bestHit.dist)
-		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
-		}
-	}
+/**
+ * @brief Goes through all the objects in the scene and bounces the
+ * given ray off the closest object visible to it.
+ * 
+ * @param ray Ray to bounce off
+ * @param twoSided Also hit triangles from behind
+ * @return RayHit Point at which the ray has bounced off
+ */
+RayHit Trace(Ray ray, bool twoSided)
+{
+	return FetchHit(ray, TraceRecord(ray, twoSided));
+}
 
-	v2 = vec3(15.0, 6.0, -65.0);
-	v1 = vec3(11.0, 6.0, -30.0);
-	v0 = vec3(11.0, -17.0, -30.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
+/**
+ * @brief Traces up to 8 coherent rays together through the 8-wide BVH. The rays share
+ * one traversal stack: a child is visited if any ray of the entry's mask hits its box,
+ * and only those rays are tested in the child. Leaf triangles are tested against all
+ * active rays at once.
+ * 
+ * @param rays Rays to trace
+ * @param hits Returns the closest HitRecord of every ray, same as calling TraceRecord() on each
+ * @param n Number of rays, at most PACKET_SIZE
+ */
+void TracePacket(const Ray* rays, HitRecord* hits, int n)
+{
+	RayPacket pk;
+	float tMax[BVH8_WIDTH], tm[BVH8_WIDTH], tEnter[BVH8_WIDTH];
+	for (int i = 0; i < BVH8_WIDTH; i++)
 	{
-		if (t > 0 && t < bestHit.dist)
+		const Ray& ray = rays[i < n ? i : 0];
+		vec3 invDir = 1.0f/ray.dir;
+		pk.orgX[i] = ray.org.x;
+		pk.orgY[i] = ray.org.y;
+		pk.orgZ[i] = ray.org.z;
+		pk.invDirX[i] = invDir.x;
+		pk.invDirY[i] = invDir.y;
+		pk.invDirZ[i] = invDir.z;
+		pk.dirX[i] = ray.dir.x;
+		pk.dirY[i] = ray.dir.y;
+		pk.dirZ[i] = ray.dir.z;
+		tMax[i] = -1.0f;
+		if (i < n)
 		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
+			hits[i] = CreateHitRecord();
+			intersectRoom(ray, hits[i]);
+			intersectPlanes(ray, hits[i]);
+			tMax[i] = hits[i].t;
 		}
 	}
+	const Bvh8& bvh = scene->bvh8;
+	if (bvh.nodes.empty())
+		return;
 
-	v0 = vec3(15.0, 6.0, -65.0);
-	v1 = vec3(11.0, 6.0, -30.0);
-	v2 = vec3(11.0, -17.0, -30.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
+	int stack[BVH8_STACK_SIZE], stackMask[BVH8_STACK_SIZE], sp = 0;
+	float stackT[BVH8_STACK_SIZE];
+	stack[sp] = 0;
+	stackMask[sp] = (1 << n) - 1;
+	stackT[sp++] = 0.0f;
+	while (sp > 0)
 	{
-		if (t > 0 && t < bestHit.dist)
+		sp--;
+		int child = stack[sp], mask = stackMask[sp];
+		/* Drop the rays whose closest hit is already in front of the box */
+		for (int i = 0; i < BVH8_WIDTH; i++)
+			if ((mask & (1 << i)) && stackT[sp] > tMax[i] && stackT[sp] == stackT[sp])
+				mask &= ~(1 << i);
+		if (!mask)
+			continue;
+		if (child >= 0)
 		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
+			const Bvh8Node& node = bvh.nodes[child];
+			for (int i = 0; i < BVH8_WIDTH; i++)
+				tm[i] = (mask & (1 << i)) ? tMax[i] : -1.0f;
+			int base = sp;
+			for (int c = 0; c < BVH8_WIDTH && node.child[c] != BVH8_EMPTY; c++)
+			{
+				int hitMask = intersectAabbPacket(pk, node, c, tm, tEnter);
+				if (!hitMask)
+					continue;
+				float tNear = FLT_MAX;
+				for (int i = 0; i < BVH8_WIDTH; i++)
+					if (hitMask & (1 << i))
+						tNear = min(tNear, tEnter[i]);
+				/* Nearest child (by its nearest ray) ends up on top */
+				int j = sp++;
+				while (j > base && stackT[j - 1] < tNear)
+				{
+					stack[j] = stack[j - 1];
+					stackMask[j] = stackMask[j - 1];
+					stackT[j] = stackT[j - 1];
+					j--;
+				}
+				stack[j] = node.child[c];
+				stackMask[j] = hitMask;
+				stackT[j] = tNear;
+			}
+			continue;
 		}
-	}
-
-	v0 = vec3(-40.0, 6.0, 20.0);
-	v1 = vec3(-40.0, 6.0, -65.0);
-	v2 = vec3(15.0, 6.0, -65.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
-	{
-		if (t > 0 && t < bestHit.dist)
+		/* Leaves test every triangle against all active rays at once */
+		const Bvh8Leaf& leaf = bvh.leaves[~child];
+		for (int i = 0; i < BVH8_WIDTH; i++)
+			tm[i] = (mask & (1 << i)) ? tMax[i] : -1.0f;
+		for (int i = leaf.firstPacket; i < leaf.firstPacket + leaf.numPackets; i++)
 		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
+			const TglPacket& tgls = bvh.packets[i];
+			for (int lane = 0; lane < BVH8_WIDTH && tgls.id[lane] >= 0; lane++)
+			{
+				int hitMask = intersectTglRays(pk, tgls, lane, tm);
+				for (int r = 0; hitMask; r++, hitMask >>= 1)
+				{
+					if (!(hitMask & 1))
+						continue;
+					int tgl = tgls.id[lane];
+					hits[r].t = tm[r];
+					hits[r].prim = tgl;
+					hits[r].mat = scene->tglMat[tgl];
+				}
+			}
 		}
-	}
-
-	v0 = vec3(15.0, 6.0, 15.0);
-	v1 = vec3(-40.0, 6.0, 15.0);
-	v2 = vec3(15.0, 6.0, -65.0);
-	if (intersectTgl_MT97(ray, v0, v1, v2, t, u, v))
-	{
-		if (t > 0 && t < bestHit.dist)
+		for (int r = 0; r < n; r++)
 		{
-			bestHit.dist = t;
-			bestHit.pos = ray.org + t*ray.dir;
-			bestHit.norm = normalize(cross(v1 - v0, v2 - v0));
-			bestHit.albedo = wallAlbedo;
-			bestHit.specular = wallSpecular;
-			bestHit.smoothness = wallSmoothness;
-			bestHit.emission = wallEmission;
-			bestHit.skybox = false;
+			if (!(mask & (1 << r)))
+				continue;
+			for (int i = leaf.firstSph; i < leaf.firstSph + leaf.numSph; i++)
+				intersectSph(rays[r], hits[r], bvh.sphs[i]);
+			tMax[r] = hits[r].t;
 		}
 	}
+	for (int r = 0; r < n; r++)
+		completeRecord(rays[r], hits[r]);
+}
 
-	return bestHit;
+/**
+ * @brief Returns the solid angle density of sampling a direction from pos uniformly
+ * within the cone which the sphere subtends
+ * 
+ * @param pos Point looking at the sphere
+ * @param sph Index of the sphere in the scene
+ * @param cosMax Returns the cosine of the half angle of the cone
+ * @return float Density of every direction in the cone, 0 if pos is inside the sphere
+ */
+float SphereConePdf(vec3 pos, int sph, float& cosMax)
+{
+	vec3 d = scene->sphPos[sph] - pos;
+	float rad = scene->sphRad[sph], dist2 = dot(d, d);
+	if (dist2 <= rad*rad)
+		return 0;
+	float sin2Max = rad*rad/dist2;
+	cosMax = sqrt(max(0.0f, 1 - sin2Max));
+	/* 1 - cosMax without cancellation for far away spheres */
+	return 1.0f/(2*3.141593f*sin2Max/(1 + cosMax));
 }
 
 /**
- * @brief Returns the color contribution from the hitting of the given ray at the rayhit
- * and updates the ray to the new reflected direction and its other properties.
+ * @brief Returns the MIS weight of emission found by a BSDF sampled ray against sampling
+ * the same emitter with SampleEmitterRay()
  * 
- * @param ray Ray that raycasted
- * @param hit RayHit where the raycasted ray had hit
- * @param e2 Random Number Generator
- * @param dist Uniform Distribution Object
- * @return vec3 Color contribution by the ray and its ray hit
+ * @param ray Ray which hit the emitter
+ * @param hit Hit on the emitter
+ * @return float Power heuristic weight, 1 if the emitter could only be hit
+ */
+float EmissionWeight(const Ray& ray, const RayHit& hit)
+{
+#if NEXT_EVENT
+	vec3 emission = hit.mat->emission;
+	if (ray.pdf <= 0 || (emission.x == 0 && emission.y == 0 && emission.z == 0))
+		return 1;
+	int sph = scene->findEmitter(hit.pos);
+	if (sph < 0)
+		return 1;
+	float cosMax, pdfLight = scene->emitterPdf(sph)*SphereConePdf(ray.org, sph, cosMax);
+	return ray.pdf*ray.pdf/(ray.pdf*ray.pdf + pdfLight*pdfLight);
+#else
+	return 1;
+#endif
+}
+
+/**
+ * @brief Next event estimation without the visibility test: picks an emissive sphere by
+ * power, samples a direction in the cone it subtends and returns the ray towards it
+ * together with its emission scattered towards wi, weighted by MIS against Shade()
+ * finding it by BSDF sampling.
+ * 
+ * @param hit RayHit to light
+ * @param wi Unit direction from the hit back along the arriving ray
+ * @param rng Random Number Generator
+ * @param shadow Returns the shadow ray and the light it carries if unblocked
+ * @return true The shadow ray needs tracing
+ * @return false The emitter cannot light the hit
  */
-vec3 Shade(Ray& ray, RayHit hit, mt19937& e2, uniform_real_distribution<float>& dist)
+bool SampleEmitterRay(const RayHit& hit, vec3 wi, Rng& rng, ShadowRay& shadow)
+{
+	/* Always draw the same numbers so the dimensions of later bounces do not shift */
+	float uPick = randfloat(rng), u1 = randfloat(rng), u2 = randfloat(rng);
+	float pickPdf, cosMax;
+	int sph = scene->sampleEmitter(uPick, pickPdf);
+	if (sph < 0)
+		return false;
+	float pdfLight = SphereConePdf(hit.pos, sph, cosMax);
+	if (pdfLight == 0)
+		return false;
+
+	float cosTheta = 1 - u1*(1 - cosMax), sinTheta = sqrt(max(0.0f, 1 - cosTheta*cosTheta));
+	float phi = 2*3.141593f*u2;
+	vec3 axis = normalize(scene->sphPos[sph] - hit.pos);
+	vec3 dir = GetTgnSpace(axis)*vec3(cos(phi)*sinTheta, sin(phi)*sinTheta, cosTheta);
+	vec3 f = EvalBsdf(hit, wi, dir);
+	if (f.x == 0 && f.y == 0 && f.z == 0)
+		return false;
+
+	shadow.ray.org = hit.pos + hit.norm*0.001f;
+	shadow.ray.dir = dir;
+	HitRecord light = CreateHitRecord();
+	light.t = FLT_MAX;
+	intersectSph(shadow.ray, light, sph);
+	if (light.t == FLT_MAX)
+		return false;
+	shadow.maxDist = light.t*(1 - 1e-3f);
+
+	pdfLight *= pickPdf;
+	float pdfBsdf = PdfBsdf(hit, wi, dir);
+	float w = pdfLight*pdfLight/(pdfLight*pdfLight + pdfBsdf*pdfBsdf);
+	shadow.light = f*scene->mats[scene->sphMat[sph]].emission*(dot(hit.norm, dir)*w/pdfLight);
+	return true;
+}
+
+vec3 ShadeLobe(Ray& ray, const RayHit& hit, Rng& rng, ShadowRay& shadow, LobeSample& lobe)
+{
+	shadow.maxDist = 0;
+	const Material& m = *hit.mat;
+	vec3 emission = m.emission*EmissionWeight(ray, hit), wi = -ray.dir;
+#if NEXT_EVENT
+	if (!SampleEmitterRay(hit, wi, rng, shadow))
+		shadow.maxDist = 0;
+#endif
+	vec3 albedo = min(1.0f - m.specular, m.albedo);
+
+	float specProb = nrg(m.specular), diffProb = nrg(albedo), roulette = randfloat(rng);
+
+	float sum = specProb + diffProb;
+	specProb /= sum;
+	diffProb /= sum;
+	ray.org = hit.pos + hit.norm*0.001f;
+	if (roulette < specProb)
+	{
+		/* Phong lobe around the mirror direction */
+		lobe.lobe = LOBE_SPECULAR;
+		lobe.axis = reflect(ray.dir, hit.norm);
+		lobe.weight = (1.0f/specProb)*m.specular;
+	}
+	else
+	{
+		/* Lambertian lobe around the normal */
+		lobe.lobe = LOBE_DIFFUSE;
+		lobe.axis = hit.norm;
+		lobe.weight = (1.0f/diffProb)*albedo;
+	}
+	lobe.smoothness = m.smoothness;
+	lobe.uCos = randfloat(rng);
+	lobe.uPhi = randfloat(rng);
+	return emission;
+}
+
+vec3 ShadeDeferred(Ray& ray, const RayHit& hit, Rng& rng, ShadowRay& shadow)
 {
+	shadow.maxDist = 0;
 	if (hit.dist > 0.01)
 	{
+		const Material& m = *hit.mat;
 		if (hit.skybox)
 		{
-			ray.nrg *= hit.albedo;
-			return hit.emission;
+			ray.nrg *= m.albedo;
+			return m.emission;
 		}
-		hit.albedo = min(1.0f - hit.specular, hit.albedo);
-
-		float specProb = nrg(hit.specular), diffProb = nrg(hit.albedo), roulette = randfloat(e2, dist);
-
-		float sum = specProb + diffProb;
-		specProb /= sum;
-		diffProb /= sum;
-		if (roulette < specProb)
+		vec3 wi = -ray.dir;
+		LobeSample lobe;
+		vec3 emission = ShadeLobe(ray, hit, rng, shadow, lobe);
+		if (lobe.lobe == LOBE_SPECULAR)
 		{
-			/* Diffuse reflection */
-			ray.org = hit.pos + hit.norm*0.001f;
-			float alpha = SmoothnessToPhongAlpha(hit.smoothness);
-			ray.dir = SampleHemi(reflect(ray.dir, hit.norm), alpha, e2, dist);
+			float alpha = SmoothnessToPhongAlpha(lobe.smoothness);
+			ray.dir = SampleHemi(lobe.axis, alpha, lobe.uCos, lobe.uPhi);
 			float f = (alpha + 2)/(alpha + 1.f);
-			ray.nrg *= (1.0f/specProb)*hit.specular*sdot(hit.norm, ray.dir, f);
+			ray.nrg *= lobe.weight*sdot(hit.norm, ray.dir, f);
 		}
 		else
 		{
-			/* Specular reflection */
-			ray.org = hit.pos + hit.norm*0.001f;
-			ray.dir = SampleHemi(hit.norm, 1.0f, e2, dist);
-			ray.nrg *= (1.0f/diffProb)*hit.albedo;
+			ray.dir = SampleHemi(lobe.axis, 1.0f, lobe.uCos, lobe.uPhi);
+			ray.nrg *= lobe.weight;
 		}
+#if NEXT_EVENT
+		ray.pdf = PdfBsdf(hit, wi, ray.dir);
+#endif
 
-		return hit.emission;
+		return emission;
 	}
 	else
 	{
@@ -679,25 +1000,41 @@ vec3 Shade(Ray& ray, RayHit hit, mt19937& e2, uniform_real_distribution<float>&
 	}
 }
 
+/**
+ * @brief Returns the color contribution from the hitting of the given ray at the rayhit
+ * and updates the ray to the new reflected direction and its other properties.
+ * 
+ * @param ray Ray that raycasted
+ * @param hit RayHit where the raycasted ray had hit
+ * @param rng Random Number Generator
+ * @return vec3 Color contribution by the ray and its ray hit
+ */
+vec3 Shade(Ray& ray, const RayHit& hit, Rng& rng)
+{
+	ShadowRay shadow;
+	vec3 emission = ShadeDeferred(ray, hit, rng, shadow);
+	if (shadow.maxDist > 0 && !Occluded(shadow.ray, shadow.maxDist))
+		emission += shadow.light;
+	return emission;
+}
+
 /**
  * @brief Returns the number of nodes in the path
  * to delete.
  * 
  * @param xl Length of the path.
- * @param e2 Random Number Generator
- * @param dist Normal Distribution Object
+ * @param numHits Maximum length of a path
+ * @param rng Random Number Generator
  * @return int Number of nodes in the path to delete
  */
-int getLd(int xl, mt19937& e2, normal_distribution<float>& dist)
+int getLd(int xl, int numHits, Rng& rng)
 {
-	return dist(e2);
+	float stddev = 1;
+	return rng.normal(numHits/2, stddev);
 }
 
 /* Assuming tentative transition function is symmetric. */
 
-const int mutations = MUTATIONS;
-const int numHits = NUM_HITS;
-
 /**
  * @brief Return the luminance of the color throughput
  * 
@@ -710,114 +1047,195 @@ float luminance(vec3 colour)
 }
 
 /**
- * @brief Sets the color of a single pixel.
- * Bottom Left is (0, 0), Top Right is (imgWidth-1, imgHeight-1)
+ * @brief Returns the camera ray through the given pixel
+ * 
  * @param x x-coordinate of the pixel
  * @param y y-coordinate of the pixel
  * @param imgWidth width of the framebuffer window
  * @param imgHeight height of the framebuffer window
- * @param frameBuffer pointer to the framebuffer
- * @param done Atomic int to track how many pixels have been rendered
+ * @return Ray Primary ray with full energy
  */
-void drawPixel(int x, int y, int imgWidth, int imgHeight, vec4* frameBuffer, atomic<int>& done)
+Ray primaryRayUnnormalized(int x, int y, int imgWidth, int imgHeight)
 {
-	random_device rd;
-	mt19937 e2(rd());
-	uniform_real_distribution<float> dist(0, 1);
-	vec4 pix;
 	ivec2 pixCoords = ivec2(x, y), dims = ivec2(imgWidth, imgHeight);
 	float maxx = 5.0, maxy = 5.0, xD = float(pixCoords.x*2 - dims.x)/dims.x, yD = float(pixCoords.y*2 - dims.y)/dims.y;
 	float xOrg = 1, yOrg = 2;
-	int nSamples = SAMPLES, lenX = 0;
+	Ray ray;
+	ray.org = vec3(xOrg, yOrg, 10.0);
+	ray.dir = vec3(xD*maxx, yD*maxy, 0.0) - ray.org;
+	ray.nrg = vec3(1.0f);
+	return ray;
+}
+
+Ray primaryRay(int x, int y, int imgWidth, int imgHeight)
+{
+	Ray ray = primaryRayUnnormalized(x, y, imgWidth, imgHeight);
+	ray.dir = normalize(ray.dir);
+	return ray;
+}
+
+bool Survives(Ray& ray, int hits, Rng& rng)
+{
+	/* Drawn on every bounce so that the dimensions of later bounces do not depend on the depth */
+	float u = randfloat(rng);
+	float q = max(ray.nrg.x, max(ray.nrg.y, ray.nrg.z));
+	if (q <= 0)
+		return false;
+	if (hits < config.minHits)
+		return true;
+	q = min(q, RR_MAX_SURVIVAL);
+	if (u >= q)
+	{
+		ray.nrg = vec3(0.0f);
+		return false;
+	}
+	ray.nrg /= q;
+	return true;
+}
+
+/**
+ * @brief Follows a path from the given camera ray for up to config.maxHits bounces, ended early
+ * by Russian roulette
+ * 
+ * @param ray Camera ray starting the path
+ * @param rng Random Number Generator driving every bounce
+ * @return vec3 Radiance carried back along the path
+ */
+vec3 TracePath(Ray ray, Rng& rng)
+{
+	vec3 rslt = vec3(0.0f);
+	for (int i = 1; i <= config.maxHits; i++)
+	{
+		RayHit hit = Trace(ray);
+		/* Shade() scatters the ray, so its light is weighted with the throughput from before */
+		vec3 throughput = ray.nrg;
+		rslt += throughput*Shade(ray, hit, rng);
+		if (!Survives(ray, i, rng))
+			break;
+	}
+	return rslt;
+}
+
+/**
+ * @brief Renders one frame's estimate of a single pixel and adds it to the film.
+ * Bottom Left is (0, 0), Top Right is (imgWidth-1, imgHeight-1)
+ * MaxHits and Mutations fix config.maxHits and config.mutations at compile time so that
+ * the path loops have constant trip counts and the PathPool its size, 0 and -1 read them at runtime.
+ * @param x x-coordinate of the pixel
+ * @param y y-coordinate of the pixel
+ * @param imgWidth width of the framebuffer window
+ * @param imgHeight height of the framebuffer window
+ * @param film Film the pixel's estimate is added to
+ * @param done Atomic int to track how many pixels have been rendered
+ * @param frame Index of the frame, together with the pixel it keys the random numbers
+ * @param primaryHit Hit of the camera ray if it was already traced, e.g. by TracePacket()
+ */
+template <int MaxHits, int Mutations>
+void drawPixelT(int x, int y, int imgWidth, int imgHeight, AccumFilm& film, atomic<int>& done, unsigned frame, const HitRecord* primaryHit)
+{
+	const int numHits = MaxHits > 0 ? MaxHits : config.maxHits;
+	const int mutations = Mutations >= 0 ? Mutations : config.mutations;
+	/* Sample j draws from stream j, the mutations continue with one stream each after the samples */
+	Rng rng(y*imgWidth + x, frame);
+	vec4 pix;
+	int nSamples = config.samples, lenX = 0;
 	vec3 rslt = vec3(0.0, 0.0, 0.0);
 	bool flag = false;
-	Path px, py;
+	PathPool<(MaxHits > 0 ? MaxHits : MAX_HITS)> pool;
+	int firstX = -1, lastX = -1;
+	pool.reset();
 	
 	for (int j = 0; j < nSamples; j++)
 	{
+		rng.setSample(j);
 
-#ifndef BIDIR
-		Ray ray;
-		ray.org = vec3(xOrg, yOrg, 10.0);
-		vec4 initial = vec4(normalize(vec3(xD*maxx, yD*maxy, 0.0) - ray.org), 1.0);
-		ray.dir = vec3((initial));
-		ray.nrg = vec3(1.0f);
-		int lenX = 0;
+		Ray ray = primaryRay(x, y, imgWidth, imgHeight);
+		if (firstX >= 0)
+			pool.release(firstX, lastX);
+		firstX = lastX = -1;
+		lenX = 0;
 		for (int i = 1; i <= numHits; i++)
 		{
-			RayHit hit = Trace(ray);
-			rslt += ray.nrg*Shade(ray, hit, e2, dist);
-			px.nodes[i - 1].hit = hit;
-			px.nodes[i - 1].ray = ray;
-			px.nodes[i - 1].rslt = rslt;
+			/* Camera rays do not change between samples, only bounces need tracing */
+			HitRecord rec = (i == 1 && primaryHit) ? *primaryHit : TraceRecord(ray);
+			vec3 throughput = ray.nrg;
+			rslt += throughput*Shade(ray, FetchHit(ray, rec), rng);
+			bool alive = Survives(ray, i, rng);
+			int node = pool.alloc();
+			if (lastX < 0)
+				firstX = node;
+			else
+				pool.nodes[lastX].nextA = node;
+			lastX = node;
+			pool.nodes[node].hit = rec;
+			pool.nodes[node].ray = ray;
+			pool.nodes[node].rslt = rslt;
 			lenX++;
-			if (ray.nrg.x == 0.0 && ray.nrg.y == 0.0 && ray.nrg.z == 0.0)
+			if (!alive)
 				break;
 		}
-
-#else
-
-		/*
-		Sample Length of Camera Path
-		lastLightPathVertex and Rslt
-		lastCameraPathVertex and Rslt
-		Check if unobstructed
-		if yes, combine, else reject.
-		*/
-
-		// number of nodes = numHits + 1
-		// cameraPathNodes max and min numHits - 1, 2
-		int cameraPathNodes = randFloat()*(numHits - 3);
-		cameraPathNodes++;
-		int lightPathNodes = numHits + 1 - cameraPathNodes;
-
-
-#endif
-
 	}
 
 	rslt /= nSamples;
 	float luminanceX = luminance(rslt);
-	vec3 colourX = rslt/luminanceX;
+	vec3 colourX = luminanceX > 0.0f ? rslt/luminanceX : vec3(0.0f);
 	vec3 mutRslt = vec3(0);
 	mutRslt += colourX;
 	list<float> dummy;
-	float stddev = 1;
-	normal_distribution<float> ldDist(numHits/2, stddev);
 
 	for (int j = 0; j < mutations; j++)
 	{
+		rng.setSample(nSamples + j);
 		int lenY = lenX;
-		int ld = getLd(lenY, e2, ldDist);
+		int ld = getLd(lenY, numHits, rng);
 		if (ld > 0)
 		{
 			ld = ld < (lenX - 1) ? ld : (lenX - 1);
 			lenY -= ld;
-			for (int i = 0; i < lenY; i++)
-				py.nodes[i] = px.nodes[i];
-			int redLen = lenY;
-			Ray ray = py.nodes[lenY - 1].ray;
-			vec3 rslt = py.nodes[lenY - 1].rslt;		
-			for (int i = redLen + 1; i <= numHits; i++)
+			/* The proposal keeps the first lenY nodes and re-traces the rest after div */
+			int div = firstX;
+			for (int i = 1; i < lenY; i++)
+				div = pool.nodes[div].nextA;
+			int redLen = lenY, lastY = div;
+			Ray ray = pool.nodes[div].ray;
+			vec3 rslt = pool.nodes[div].rslt;
+			bool alive = ray.nrg.x > 0 || ray.nrg.y > 0 || ray.nrg.z > 0;
+			for (int i = redLen + 1; alive && i <= numHits; i++)
 			{
-				RayHit hit = Trace(ray);
-				rslt += ray.nrg*Shade(ray, hit, e2, dist);
-				py.nodes[i - 1].ray = ray;
-				py.nodes[i - 1].hit = hit;
-				py.nodes[i - 1].rslt = rslt;
+				HitRecord rec = TraceRecord(ray);
+				vec3 throughput = ray.nrg;
+				rslt += throughput*Shade(ray, FetchHit(ray, rec), rng);
+				alive = Survives(ray, i, rng);
+				int node = pool.alloc();
+				if (lastY == div)
+					pool.nodes[div].nextM = node;
+				else
+					pool.nodes[lastY].nextA = node;
+				lastY = node;
+				pool.nodes[node].ray = ray;
+				pool.nodes[node].hit = rec;
+				pool.nodes[node].rslt = rslt;
 				lenY++;
 			}
 			float luminanceY = luminance(rslt);
-			vec3 colourY = rslt/luminanceY;
+			vec3 colourY = luminanceY > 0.0f ? rslt/luminanceY : vec3(0.0f);
 			float axy = min(1.0f, luminanceY/luminanceX);
 			mutRslt += axy*colourX + (1 - axy)*colourY;
-			if (randfloat(e2, dist) < axy)
+			PathNode& d = pool.nodes[div];
+			if (randfloat(rng) < axy)
 			{
-				px = py;
+				/* The proposal's suffix replaces the current one, which goes back to the pool */
+				if (d.nextA >= 0)
+					pool.release(d.nextA, lastX);
+				d.nextA = d.nextM;
+				lastX = lastY;
 				colourX = colourY;
 				luminanceX = luminanceY;
 				lenX = lenY;
 			}
+			else if (d.nextM >= 0)
+				pool.release(d.nextM, lastY);
+			d.nextM = -1;
 		}
 		else
 			mutRslt += colourX;
@@ -827,6 +1245,70 @@ void drawPixel(int x, int y, int imgWidth, int imgHeight, vec4* frameBuffer, ato
 		pix = vec4(mutRslt.r, mutRslt.g, mutRslt.b, 1.0);
 	else
 		pix = vec4(rslt.r, rslt.g, rslt.b, 1.0);
-	frameBuffer[y*imgWidth + x] = pix;
+	film.add(y*imgWidth + x, vec3(pix));
 	done++;
-}
\ No newline at end of file
+}
+
+typedef void (*PixelKernel)(int, int, int, int, AccumFilm&, atomic<int>&, unsigned, const HitRecord*);
+
+/**
+ * @brief Returns the drawPixelT() instance specialized for the current configuration,
+ * or the generic one if its (maxHits, mutations) pair is not a common one
+ * 
+ */
+static PixelKernel selectKernel()
+{
+	int hits = config.maxHits, muts = config.mutations;
+	if (hits == 10 && muts == 100)
+		return drawPixelT<10, 100>;
+	if (hits == 10 && muts == 0)
+		return drawPixelT<10, 0>;
+	if (hits == 5 && muts == 100)
+		return drawPixelT<5, 100>;
+	if (hits == 5 && muts == 0)
+		return drawPixelT<5, 0>;
+	if (hits == 20 && muts == 100)
+		return drawPixelT<20, 100>;
+	return drawPixelT<0, -1>;
+}
+
+void drawPixel(int x, int y, int imgWidth, int imgHeight, AccumFilm& film, atomic<int>& done, unsigned frame, const HitRecord* primaryHit)
+{
+	selectKernel()(x, y, imgWidth, imgHeight, film, done, frame, primaryHit);
+}
+
+/**
+ * @brief Renders the pixels [x0, x1) of row y into the film. In packet mode the camera
+ * rays of PACKET_SIZE neighbouring pixels are traced together by TracePacket(), after
+ * which every pixel continues its path with single ray tracing.
+ * @param x0 First pixel of the row span
+ * @param x1 One past the last pixel of the row span
+ * @param y y-coordinate of the row
+ * @param imgWidth width of the framebuffer window
+ * @param imgHeight height of the framebuffer window
+ * @param film Film the pixel's estimate is added to
+ * @param done Atomic int to track how many pixels have been rendered
+ * @param frame Index of the frame, passed on to drawPixel()
+ * @param packets Trace camera rays in packets
+ */
+void drawPixels(int x0, int x1, int y, int imgWidth, int imgHeight, AccumFilm& film, atomic<int>& done, unsigned frame, bool packets)
+{
+	PixelKernel kernel = selectKernel();
+	if (!packets)
+	{
+		for (int x = x0; x < x1; x++)
+			kernel(x, y, imgWidth, imgHeight, film, done, frame, nullptr);
+		return;
+	}
+	Ray rays[PACKET_SIZE];
+	HitRecord hits[PACKET_SIZE];
+	for (int x = x0; x < x1; x += PACKET_SIZE)
+	{
+		int n = min(PACKET_SIZE, x1 - x);
+		for (int i = 0; i < n; i++)
+			rays[i] = primaryRay(x + i, y, imgWidth, imgHeight);
+		TracePacket(rays, hits, n);
+		for (int i = 0; i < n; i++)
+			kernel(x + i, y, imgWidth, imgHeight, film, done, frame, &hits[i]);
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+/**
+ * @file SplatFilm.hpp
+ * @author
+ * @brief Contains the film which several threads can splat contributions into at once
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <atomic>
+#include <vector>
+
+#include "MltPixel.hpp"
+
+/**
+ * @brief Struct for an RGB film of imgWidth*imgHeight pixels, bottom row first, whose
+ * pixels are updated with atomic adds. Used by the integrators which deposit light
+ * anywhere in the image rather than only in the pixel being rendered.
+ *
+ */
+struct SplatFilm
+{
+	int imgWidth = 0;
+	int imgHeight = 0;
+
+	/* RGB sums, three floats per pixel */
+	std::vector<std::atomic<float>> rgb;
+
+	/**
+	 * @brief Resizes the film and clears it to black
+	 *
+	 */
+	void reset(int width, int height)
+	{
+		imgWidth = width;
+		imgHeight = height;
+		rgb = std::vector<std::atomic<float>>(3*width*height);
+		for (std::atomic<float>& v : rgb)
+			v.store(0.0f);
+	}
+
+	/**
+	 * @brief Atomically adds a color to the given pixel
+	 *
+	 */
+	void splat(int pix, vec3 c)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			std::atomic<float>& dst = rgb[3*pix + i];
+			float old = dst.load(std::memory_order_relaxed);
+			while (!dst.compare_exchange_weak(old, old + c[i], std::memory_order_relaxed))
+				;
+		}
+	}
+
+	/**
+	 * @brief Returns the sum of every splat into the given pixel
+	 *
+	 */
+	vec3 get(int pix) const
+	{
+		return vec3(rgb[3*pix].load(), rgb[3*pix + 1].load(), rgb[3*pix + 2].load());
+	}
+};
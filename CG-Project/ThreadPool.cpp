@@ -0,0 +1,269 @@
+/**
+ * @file ThreadPool.cpp
+ * @author
+ * @brief Contains the implementation of the persistent work-stealing thread pool
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "ThreadPool.hpp"
+
+using namespace std;
+
+int parseTileOrder(const char* name)
+{
+	if (!strcmp(name, "scanline"))
+		return TILE_ORDER_SCANLINE;
+	if (!strcmp(name, "morton"))
+		return TILE_ORDER_MORTON;
+	if (!strcmp(name, "hilbert"))
+		return TILE_ORDER_HILBERT;
+	return -1;
+}
+
+/**
+ * @brief Spreads the low 16 bits of v to the even bits
+ *
+ */
+static uint32_t spreadBits(uint32_t v)
+{
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+/**
+ * @brief Returns the distance of the cell along the Hilbert curve filling an n*n grid,
+ * n a power of two
+ *
+ */
+static uint32_t hilbertIndex(uint32_t x, uint32_t y, uint32_t n)
+{
+	uint32_t d = 0;
+	for (uint32_t s = n/2; s > 0; s /= 2)
+	{
+		uint32_t rx = (x & s) != 0, ry = (y & s) != 0;
+		d += s*s*((3*rx) ^ ry);
+		/* Rotate the quadrant so the curve inside it starts where the last one ended */
+		if (!ry)
+		{
+			if (rx)
+			{
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			swap(x, y);
+		}
+	}
+	return d;
+}
+
+void orderTiles(vector<Tile>& tiles, int order)
+{
+	int tileW = 1, tileH = 1;
+	for (const Tile& t : tiles)
+	{
+		tileW = max(tileW, t.x1 - t.x0);
+		tileH = max(tileH, t.y1 - t.y0);
+	}
+	uint32_t cols = 1, n = 1;
+	for (const Tile& t : tiles)
+	{
+		cols = max(cols, uint32_t(t.x0/tileW + 1));
+		while (n <= uint32_t(max(t.x0/tileW, t.y0/tileH)))
+			n *= 2;
+	}
+
+	vector<pair<uint32_t, Tile>> keyed;
+	keyed.reserve(tiles.size());
+	for (const Tile& t : tiles)
+	{
+		uint32_t x = t.x0/tileW, y = t.y0/tileH, key;
+		if (order == TILE_ORDER_MORTON)
+			key = spreadBits(x) | (spreadBits(y) << 1);
+		else if (order == TILE_ORDER_HILBERT)
+			key = hilbertIndex(x, y, n);
+		else
+			key = y*cols + x;
+		keyed.push_back({key, t});
+	}
+	stable_sort(keyed.begin(), keyed.end(), [](const pair<uint32_t, Tile>& a, const pair<uint32_t, Tile>& b) { return a.first < b.first; });
+	for (size_t i = 0; i < tiles.size(); i++)
+		tiles[i] = keyed[i].second;
+}
+
+void FrameHandle::wait()
+{
+	if (!state)
+		return;
+	unique_lock<mutex> lk(state->lock);
+	state->finished.wait(lk, [this] { return state->tilesLeft == 0; });
+}
+
+bool FrameHandle::waitFor(chrono::milliseconds timeout)
+{
+	if (!state)
+		return true;
+	unique_lock<mutex> lk(state->lock);
+	return state->finished.wait_for(lk, timeout, [this] { return state->tilesLeft == 0; });
+}
+
+void FrameHandle::cancel()
+{
+	if (state)
+		state->cancelled = true;
+}
+
+bool FrameHandle::isDone() const
+{
+	return !state || state->tilesLeft == 0;
+}
+
+bool FrameHandle::isCancelled() const
+{
+	return state && state->cancelled;
+}
+
+int FrameHandle::pixelsDone() const
+{
+	return state ? state->done.load() : 0;
+}
+
+ThreadPool::ThreadPool(unsigned numThreads)
+{
+	if (numThreads == 0)
+		numThreads = max(1u, thread::hardware_concurrency());
+	for (unsigned i = 0; i < numThreads; i++)
+		workers.emplace_back(new Worker());
+	for (unsigned i = 0; i < numThreads; i++)
+		threads.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lk(sleepLock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (thread& t : threads)
+		t.join();
+}
+
+FrameHandle ThreadPool::renderFrame(int imgWidth, int imgHeight, int tileSize, TileFunc func)
+{
+	tileSize = max(1, tileSize);
+	vector<Tile> tiles;
+	for (int y = 0; y < imgHeight; y += tileSize)
+		for (int x = 0; x < imgWidth; x += tileSize)
+			tiles.push_back({x, y, min(x + tileSize, imgWidth), min(y + tileSize, imgHeight)});
+	return renderTiles(tiles, move(func));
+}
+
+FrameHandle ThreadPool::renderTiles(const vector<Tile>& tiles, TileFunc func)
+{
+	shared_ptr<FrameState> frame = make_shared<FrameState>();
+	frame->func = move(func);
+	if (tiles.empty())
+		return FrameHandle(frame);
+	frame->tilesLeft = (int)tiles.size();
+
+	/* Every worker gets a contiguous run of the curve, queued backwards as workers pop from the back and thieves from the front */
+	vector<Tile> ordered = tiles;
+	orderTiles(ordered, tileOrder);
+	size_t numWorkers = workers.size();
+	for (size_t i = 0; i < numWorkers; i++)
+	{
+		size_t first = ordered.size()*i/numWorkers, last = ordered.size()*(i + 1)/numWorkers;
+		Worker& w = *workers[i];
+		lock_guard<mutex> lk(w.lock);
+		for (size_t t = last; t > first; t--)
+			w.tasks.push_back({frame, ordered[t - 1]});
+	}
+	{
+		lock_guard<mutex> lk(sleepLock);
+		pending += (int)tiles.size();
+	}
+	wake.notify_all();
+	return FrameHandle(frame);
+}
+
+/**
+ * @brief Pops the most recently queued task of the worker's own deque.
+ *
+ */
+bool ThreadPool::popLocal(unsigned id, Task& task)
+{
+	Worker& w = *workers[id];
+	lock_guard<mutex> lk(w.lock);
+	if (w.tasks.empty())
+		return false;
+	task = move(w.tasks.back());
+	w.tasks.pop_back();
+	return true;
+}
+
+/**
+ * @brief Steals the oldest task from the front of another worker's deque.
+ *
+ */
+bool ThreadPool::steal(unsigned id, Task& task)
+{
+	unsigned n = (unsigned)workers.size();
+	for (unsigned i = 1; i < n; i++)
+	{
+		Worker& w = *workers[(id + i)%n];
+		lock_guard<mutex> lk(w.lock);
+		if (w.tasks.empty())
+			continue;
+		task = move(w.tasks.front());
+		w.tasks.pop_front();
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::runTask(Task& task)
+{
+	FrameState& frame = *task.frame;
+	if (!frame.cancelled)
+		frame.func(task.tile, frame.done);
+	if (--frame.tilesLeft == 0)
+	{
+		lock_guard<mutex> lk(frame.lock);
+		frame.finished.notify_all();
+	}
+}
+
+/**
+ * @brief Main loop of a single worker thread.
+ *
+ */
+void ThreadPool::run(unsigned id)
+{
+	Task task;
+	while (true)
+	{
+		if (popLocal(id, task) || steal(id, task))
+		{
+			pending--;
+			runTask(task);
+			task.frame.reset();
+			continue;
+		}
+		unique_lock<mutex> lk(sleepLock);
+		wake.wait(lk, [this] { return stopping || pending > 0; });
+		if (stopping && pending == 0)
+			return;
+	}
+}
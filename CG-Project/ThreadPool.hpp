@@ -0,0 +1,210 @@
+#pragma once
+
+/**
+ * @file ThreadPool.hpp
+ * @author
+ * @brief Contains the persistent work-stealing thread pool used to render frames tile by tile
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define TILE_SIZE 32
+
+/* Orders the tiles of a frame are dealt to the workers in */
+#define TILE_ORDER_SCANLINE 0
+#define TILE_ORDER_MORTON 1
+#define TILE_ORDER_HILBERT 2
+
+/**
+ * @brief Struct for a rectangular block of pixels [x0, x1) x [y0, y1)
+ *
+ */
+struct Tile
+{
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+};
+
+/**
+ * @brief Callback run by the pool for every tile of a frame.
+ * The atomic int tracks the number of pixels rendered in the frame.
+ *
+ */
+typedef std::function<void(const Tile&, std::atomic<int>&)> TileFunc;
+
+/**
+ * @brief Returns the tile order with the given name, scanline, morton or hilbert, or -1
+ * if there is none
+ *
+ */
+int parseTileOrder(const char* name);
+
+/**
+ * @brief Sorts the tiles of a grid along a space filling curve, so that tiles next to
+ * each other in the vector also lie next to each other in the image. Tiles need not
+ * cover the whole grid.
+ *
+ * @param tiles Tiles whose corners lie on a grid of the size of the largest tile
+ * @param order One of the TILE_ORDER_ orders
+ */
+void orderTiles(std::vector<Tile>& tiles, int order);
+
+/**
+ * @brief Shared bookkeeping of a single frame submitted to the pool
+ *
+ */
+struct FrameState
+{
+	TileFunc func;
+	std::atomic<int> tilesLeft{0};
+	std::atomic<int> done{0};
+	std::atomic<bool> cancelled{false};
+	std::mutex lock;
+	std::condition_variable finished;
+};
+
+/**
+ * @brief Completion/cancel handle returned for every frame submitted to the pool
+ *
+ */
+class FrameHandle
+{
+public:
+	FrameHandle() = default;
+	explicit FrameHandle(std::shared_ptr<FrameState> state) : state(state)
+	{}
+
+	/**
+	 * @brief Blocks until every tile of the frame has been rendered or skipped.
+	 *
+	 */
+	void wait();
+
+	/**
+	 * @brief Blocks until the frame is finished or the timeout expires.
+	 *
+	 * @param timeout Maximum time to wait for
+	 * @return true The frame is finished
+	 * @return false The timeout expired first
+	 */
+	bool waitFor(std::chrono::milliseconds timeout);
+
+	/**
+	 * @brief Requests the frame to stop. Tiles which have not started yet are skipped.
+	 *
+	 */
+	void cancel();
+
+	bool isDone() const;
+	bool isCancelled() const;
+
+	/**
+	 * @brief Returns the number of pixels rendered so far in the frame
+	 *
+	 */
+	int pixelsDone() const;
+
+private:
+	std::shared_ptr<FrameState> state;
+};
+
+/**
+ * @brief Persistent pool of render threads. Every worker owns a deque of tiles,
+ * pops work from its back and steals from the front of the other workers' deques
+ * once its own deque runs dry. The tiles of a frame are sorted in the pool's tile
+ * order and every worker gets a contiguous run of them, so a worker traces rays
+ * through neighbouring parts of the scene and keeps its BVH nodes and triangles in
+ * cache.
+ *
+ */
+class ThreadPool
+{
+public:
+	/**
+	 * @brief Starts the worker threads.
+	 *
+	 * @param numThreads Number of workers, 0 uses the hardware concurrency
+	 */
+	explicit ThreadPool(unsigned numThreads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/**
+	 * @brief Splits the image into tiles and queues them on the workers.
+	 *
+	 * @param imgWidth Width of the image
+	 * @param imgHeight Height of the image
+	 * @param tileSize Side of a square tile in pixels
+	 * @param func Callback rendering a single tile
+	 * @return FrameHandle Handle to wait on or cancel the frame
+	 */
+	FrameHandle renderFrame(int imgWidth, int imgHeight, int tileSize, TileFunc func);
+
+	/**
+	 * @brief Queues the given tiles on the workers, e.g. only those of an image which
+	 * still need samples.
+	 *
+	 * @param tiles Tiles to render
+	 * @param func Callback rendering a single tile
+	 * @return FrameHandle Handle to wait on or cancel the frame
+	 */
+	FrameHandle renderTiles(const std::vector<Tile>& tiles, TileFunc func);
+
+	unsigned size() const
+	{
+		return (unsigned)workers.size();
+	}
+
+	/**
+	 * @brief Sets the order the tiles of later frames are dealt in
+	 *
+	 * @param order One of the TILE_ORDER_ orders
+	 */
+	void setTileOrder(int order)
+	{
+		tileOrder = order;
+	}
+
+private:
+	struct Task
+	{
+		std::shared_ptr<FrameState> frame;
+		Tile tile;
+	};
+
+	struct Worker
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	bool popLocal(unsigned id, Task& task);
+	bool steal(unsigned id, Task& task);
+	void run(unsigned id);
+	void runTask(Task& task);
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::atomic<int> pending{0};
+	bool stopping = false;
+	int tileOrder = TILE_ORDER_HILBERT;
+};
@@ -0,0 +1,339 @@
+/**
+ * @file Wavefront.cpp
+ * @author
+ * @brief Contains the stages of the wavefront path tracer
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+
+#include "BatchMath.hpp"
+#include "ShadeBatch.hpp"
+#include "Wavefront.hpp"
+
+using namespace std;
+
+void RayQueue::reset(int n)
+{
+	for (vector<float>* v : {&orgX, &orgY, &orgZ, &dirX, &dirY, &dirZ, &nrgR, &nrgG, &nrgB, &pdf})
+		v->resize(n);
+	path.resize(n);
+	size = 0;
+}
+
+void HitQueue::reset(int n)
+{
+	t.resize(n);
+	prim.resize(n);
+	mat.resize(n);
+	baryU.resize(n);
+	baryV.resize(n);
+}
+
+void ShadowQueue::reset(int n)
+{
+	for (vector<float>* v : {&orgX, &orgY, &orgZ, &dirX, &dirY, &dirZ, &maxDist, &lightR, &lightG, &lightB})
+		v->resize(n);
+	slot.resize(n);
+	size = 0;
+}
+
+/**
+ * @brief Struct for the queues and path state of the tile a thread is rendering. Kept per
+ * thread, so the queues are only allocated once.
+ *
+ */
+struct WaveState
+{
+	RayQueue rays, next;
+	HitQueue hits;
+	ShadowQueue shadows;
+	/* Throughput before the bounce and light found at it, per entry of rays */
+	vector<float> thrR, thrG, thrB;
+	vector<float> lightR, lightG, lightB;
+	/* Per path: pixel keying its random numbers, next dimension to draw, radiance summed over the samples */
+	vector<uint32_t> pixel, dim;
+	vector<vec3> rslt;
+	/* Order the rays of the queue are traced in, and the bin keys sorting it */
+	vector<int> order;
+	vector<pair<uint32_t, int>> keys;
+	/* Hits whose lobes are sampled together, and the surface every ray hit */
+	ShadeBatch batch;
+	vector<RayHit> surf;
+
+	void reset(int n)
+	{
+		rays.reset(n);
+		next.reset(n);
+		hits.reset(n);
+		shadows.reset(n);
+		for (vector<float>* v : {&thrR, &thrG, &thrB, &lightR, &lightG, &lightB})
+			v->resize(n);
+		pixel.resize(n);
+		dim.resize(n);
+		rslt.assign(n, vec3(0.0f));
+		order.resize(n);
+		keys.resize(n);
+		batch.reset(n);
+		surf.resize(n);
+	}
+};
+
+static thread_local WaveState waveState;
+
+/**
+ * @brief Spreads the low 4 bits of v to every third bit
+ *
+ */
+static uint32_t spreadBits3(uint32_t v)
+{
+	v &= 0xF;
+	v = (v | (v << 4)) & 0x0C3;
+	v = (v | (v << 2)) & 0x249;
+	return v;
+}
+
+/**
+ * @brief Sorts the rays [first, last) of the queue by direction octant, then by the Morton
+ * index of their origin's cell in a BIN_CELLS^3 grid over the origins of the batch
+ *
+ */
+static void binRays(const RayQueue& rays, int first, int last, vector<pair<uint32_t, int>>& keys, vector<int>& order)
+{
+	vec3 lo = vec3(FLT_MAX), hi = vec3(-FLT_MAX);
+	for (int i = first; i < last; i++)
+	{
+		vec3 org = vec3(rays.orgX[i], rays.orgY[i], rays.orgZ[i]);
+		lo = min(lo, org);
+		hi = max(hi, org);
+	}
+	vec3 scale = float(BIN_CELLS)/max(hi - lo, vec3(1e-6f));
+	for (int i = first; i < last; i++)
+	{
+		uint32_t octant = (rays.dirX[i] < 0) | ((rays.dirY[i] < 0) << 1) | ((rays.dirZ[i] < 0) << 2);
+		uint32_t cx = min(BIN_CELLS - 1, int((rays.orgX[i] - lo.x)*scale.x));
+		uint32_t cy = min(BIN_CELLS - 1, int((rays.orgY[i] - lo.y)*scale.y));
+		uint32_t cz = min(BIN_CELLS - 1, int((rays.orgZ[i] - lo.z)*scale.z));
+		keys[i] = {(octant << 12) | spreadBits3(cx) | (spreadBits3(cy) << 1) | (spreadBits3(cz) << 2), i};
+	}
+	sort(keys.begin() + first, keys.begin() + last);
+	for (int i = first; i < last; i++)
+		order[i] = keys[i].second;
+}
+
+void Wavefront::resetStats()
+{
+	for (atomic<long long>& ns : stageNs)
+		ns = 0;
+	numSecondary = 0;
+	sameHitQueue = 0;
+	sameHitTraced = 0;
+}
+
+double Wavefront::hitCoherence(bool traced) const
+{
+	long long n = numSecondary;
+	return n > 0 ? double(traced ? sameHitTraced : sameHitQueue)/n : 0.0;
+}
+
+double Wavefront::stageTime(int stage) const
+{
+	return stageNs[stage]*1e-9;
+}
+
+const char* Wavefront::stageName(int stage)
+{
+	static const char* names[WAVE_STAGES] = {"generate", "bin", "extend", "shade", "shadow", "accumulate"};
+	return names[stage];
+}
+
+void Wavefront::renderTile(const Tile& tile, int imgWidth, int imgHeight, AccumFilm& film, atomic<int>& done, unsigned frame, bool packets)
+{
+	const RenderConfig& cfg = getConfig();
+	WaveState& st = waveState;
+	int tileWidth = tile.x1 - tile.x0, n = tileWidth*(tile.y1 - tile.y0);
+	st.reset(n);
+
+	auto last = chrono::steady_clock::now();
+	auto lap = [&](int stage)
+	{
+		auto now = chrono::steady_clock::now();
+		stageNs[stage] += chrono::duration_cast<chrono::nanoseconds>(now - last).count();
+		last = now;
+	};
+
+	/* One wave per sample, so every pixel sums its samples in the same order as drawPixel() */
+	for (int j = 0; j < cfg.samples; j++)
+	{
+		/* Generate: one camera ray per pixel, path p is pixel p of the tile */
+		st.rays.size = 0;
+		for (int p = 0; p < n; p++)
+		{
+			int x = tile.x0 + p%tileWidth, y = tile.y0 + p/tileWidth;
+			st.rays.push(primaryRayUnnormalized(x, y, imgWidth, imgHeight), p);
+			st.pixel[p] = y*imgWidth + x;
+			st.dim[p] = 0;
+		}
+		Vec3Stream dirs = {st.rays.dirX.data(), st.rays.dirY.data(), st.rays.dirZ.data()};
+		BatchNormalize(dirs, dirs, n);
+		lap(WAVE_GENERATE);
+
+		for (int bounce = 1; bounce <= cfg.maxHits && st.rays.size > 0; bounce++)
+		{
+			/* Bin: sort the scattered rays a batch at a time */
+			RayQueue& rays = st.rays;
+			for (int i = 0; i < rays.size; i++)
+				st.order[i] = i;
+			if (bounce > 1 && binBatch > 0)
+				for (int i = 0; i < rays.size; i += binBatch)
+					binRays(rays, i, min(rays.size, i + binBatch), st.keys, st.order);
+			lap(WAVE_BIN);
+
+			/* Extend: closest hit of every queued ray, in binned order */
+			if (packets && bounce == 1)
+			{
+				Ray pk[PACKET_SIZE];
+				HitRecord recs[PACKET_SIZE];
+				for (int i = 0; i < rays.size; i += PACKET_SIZE)
+				{
+					int m = min(PACKET_SIZE, rays.size - i);
+					for (int k = 0; k < m; k++)
+						pk[k] = rays.get(i + k);
+					TracePacket(pk, recs, m);
+					for (int k = 0; k < m; k++)
+						st.hits.set(i + k, recs[k]);
+				}
+			}
+			else
+				for (int i = 0; i < rays.size; i++)
+					st.hits.set(st.order[i], TraceRecord(rays.get(st.order[i])));
+			lap(WAVE_EXTEND);
+			if (bounce > 1)
+			{
+				long long sameQueue = 0, sameTraced = 0;
+				for (int i = 1; i < rays.size; i++)
+				{
+					sameQueue += st.hits.prim[i] == st.hits.prim[i - 1];
+					sameTraced += st.hits.prim[st.order[i]] == st.hits.prim[st.order[i - 1]];
+				}
+				numSecondary += rays.size;
+				sameHitQueue += sameQueue;
+				sameHitTraced += sameTraced;
+			}
+
+			/* Shade: scatter the rays, queue the survivors and the shadow rays */
+			st.next.size = 0;
+			st.shadows.size = 0;
+			st.batch.size = 0;
+			for (int i = 0; i < rays.size; i++)
+			{
+				Ray ray = rays.get(i);
+				int p = rays.path[i];
+				RayHit hit = FetchHit(ray, st.hits.get(i));
+				Rng rng(st.pixel[p], frame);
+				rng.setSample(j);
+				rng.seek(st.dim[p]);
+				st.thrR[i] = ray.nrg.x;
+				st.thrG[i] = ray.nrg.y;
+				st.thrB[i] = ray.nrg.z;
+				ShadowRay shadow;
+				vec3 light;
+				bool lobed = batchShade && hit.dist > 0.01 && !hit.skybox;
+				if (lobed)
+				{
+					/* Only the lobe is picked here, the batch samples the directions below */
+					LobeSample lobe;
+					light = ShadeLobe(ray, hit, rng, shadow, lobe);
+					st.batch.push(lobe, hit.norm, ray.nrg, st.hits.mat[i], i);
+					st.surf[i] = hit;
+					rays.orgX[i] = ray.org.x;
+					rays.orgY[i] = ray.org.y;
+					rays.orgZ[i] = ray.org.z;
+				}
+				else
+					light = ShadeDeferred(ray, hit, rng, shadow);
+				st.lightR[i] = light.x;
+				st.lightG[i] = light.y;
+				st.lightB[i] = light.z;
+				if (shadow.maxDist > 0)
+					st.shadows.push(shadow, i);
+				if (!batchShade)
+				{
+					if (Survives(ray, bounce, rng))
+						st.next.push(ray, p);
+				}
+				else if (!lobed)
+					rays.set(i, ray);
+				st.dim[p] = rng.dimension;
+			}
+			if (batchShade)
+			{
+				/* Sample the lobes grouped by material, then finish every ray like ShadeDeferred() */
+				st.batch.sortByMaterial();
+				SampleLobes(st.batch);
+				ShadeBatch& b = st.batch;
+				for (int e = 0; e < b.size; e++)
+				{
+					int i = b.slot[e];
+					vec3 wi = -vec3(rays.dirX[i], rays.dirY[i], rays.dirZ[i]), dir = vec3(b.dirX[e], b.dirY[e], b.dirZ[e]);
+					rays.dirX[i] = dir.x;
+					rays.dirY[i] = dir.y;
+					rays.dirZ[i] = dir.z;
+					rays.nrgR[i] = b.nrgR[e];
+					rays.nrgG[i] = b.nrgG[e];
+					rays.nrgB[i] = b.nrgB[e];
+#if NEXT_EVENT
+					rays.pdf[i] = PdfBsdf(st.surf[i], wi, dir);
+#endif
+				}
+				for (int i = 0; i < rays.size; i++)
+				{
+					Ray ray = rays.get(i);
+					int p = rays.path[i];
+					Rng rng(st.pixel[p], frame);
+					rng.setSample(j);
+					rng.seek(st.dim[p]);
+					if (Survives(ray, bounce, rng))
+						st.next.push(ray, p);
+					st.dim[p] = rng.dimension;
+				}
+			}
+			lap(WAVE_SHADE);
+
+			/* Shadow: add the light of the unblocked shadow rays */
+			ShadowQueue& sh = st.shadows;
+			for (int i = 0; i < sh.size; i++)
+			{
+				Ray ray;
+				ray.org = vec3(sh.orgX[i], sh.orgY[i], sh.orgZ[i]);
+				ray.dir = vec3(sh.dirX[i], sh.dirY[i], sh.dirZ[i]);
+				if (Occluded(ray, sh.maxDist[i]))
+					continue;
+				int s = sh.slot[i];
+				st.lightR[s] += sh.lightR[i];
+				st.lightG[s] += sh.lightG[i];
+				st.lightB[s] += sh.lightB[i];
+			}
+			lap(WAVE_SHADOW);
+
+			/* Accumulate: the light of the bounce weighted by the throughput from before it */
+			for (int i = 0; i < rays.size; i++)
+				st.rslt[rays.path[i]] += vec3(st.thrR[i], st.thrG[i], st.thrB[i])*vec3(st.lightR[i], st.lightG[i], st.lightB[i]);
+			swap(st.rays, st.next);
+			lap(WAVE_ACCUMULATE);
+		}
+	}
+
+	for (int p = 0; p < n; p++)
+	{
+		film.add(st.pixel[p], st.rslt[p]/float(cfg.samples));
+		done++;
+	}
+	lap(WAVE_ACCUMULATE);
+}
@@ -0,0 +1,262 @@
+#pragma once
+
+/**
+ * @file Wavefront.hpp
+ * @author
+ * @brief Contains the wavefront path tracer which runs every bounce of a tile's paths stage by stage
+ * @version 0.1
+ * @date 2022-12-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "AccumFilm.hpp"
+#include "MltPixel.hpp"
+#include "ThreadPool.hpp"
+
+/* Stages of the wavefront, in the order of Wavefront::stageTime() */
+#define WAVE_GENERATE 0
+#define WAVE_BIN 1
+#define WAVE_EXTEND 2
+#define WAVE_SHADE 3
+#define WAVE_SHADOW 4
+#define WAVE_ACCUMULATE 5
+#define WAVE_STAGES 6
+
+/* Cells per axis of the grid the origins of a batch are binned into */
+#define BIN_CELLS 16
+
+/**
+ * @brief Struct for a queue of rays, one array per component
+ *
+ */
+struct RayQueue
+{
+	std::vector<float> orgX, orgY, orgZ;
+	std::vector<float> dirX, dirY, dirZ;
+	std::vector<float> nrgR, nrgG, nrgB;
+	std::vector<float> pdf;
+	/* Path every ray continues */
+	std::vector<int> path;
+	int size = 0;
+
+	/**
+	 * @brief Empties the queue and makes room for n rays
+	 *
+	 */
+	void reset(int n);
+
+	void push(const Ray& ray, int p)
+	{
+		set(size, ray);
+		path[size++] = p;
+	}
+
+	void set(int i, const Ray& ray)
+	{
+		orgX[i] = ray.org.x;
+		orgY[i] = ray.org.y;
+		orgZ[i] = ray.org.z;
+		dirX[i] = ray.dir.x;
+		dirY[i] = ray.dir.y;
+		dirZ[i] = ray.dir.z;
+		nrgR[i] = ray.nrg.x;
+		nrgG[i] = ray.nrg.y;
+		nrgB[i] = ray.nrg.z;
+		pdf[i] = ray.pdf;
+	}
+
+	Ray get(int i) const
+	{
+		Ray ray;
+		ray.org = vec3(orgX[i], orgY[i], orgZ[i]);
+		ray.dir = vec3(dirX[i], dirY[i], dirZ[i]);
+		ray.nrg = vec3(nrgR[i], nrgG[i], nrgB[i]);
+		ray.pdf = pdf[i];
+		return ray;
+	}
+};
+
+/**
+ * @brief Struct for the closest hits of a RayQueue, one array per HitRecord field
+ *
+ */
+struct HitQueue
+{
+	std::vector<float> t;
+	std::vector<uint32_t> prim;
+	std::vector<int> mat;
+	std::vector<float> baryU, baryV;
+
+	/**
+	 * @brief Makes room for n hits
+	 *
+	 */
+	void reset(int n);
+
+	void set(int i, const HitRecord& rec)
+	{
+		t[i] = rec.t;
+		prim[i] = rec.prim;
+		mat[i] = rec.mat;
+		baryU[i] = rec.bary.x;
+		baryV[i] = rec.bary.y;
+	}
+
+	HitRecord get(int i) const
+	{
+		HitRecord rec;
+		rec.t = t[i];
+		rec.prim = prim[i];
+		rec.mat = mat[i];
+		rec.bary = vec2(baryU[i], baryV[i]);
+		return rec;
+	}
+};
+
+/**
+ * @brief Struct for a queue of next event estimation shadow rays, one array per component
+ *
+ */
+struct ShadowQueue
+{
+	std::vector<float> orgX, orgY, orgZ;
+	std::vector<float> dirX, dirY, dirZ;
+	std::vector<float> maxDist;
+	std::vector<float> lightR, lightG, lightB;
+	/* Entry of the RayQueue whose emission the light is added to */
+	std::vector<int> slot;
+	int size = 0;
+
+	/**
+	 * @brief Empties the queue and makes room for n shadow rays
+	 *
+	 */
+	void reset(int n);
+
+	void push(const ShadowRay& shadow, int s)
+	{
+		int i = size++;
+		orgX[i] = shadow.ray.org.x;
+		orgY[i] = shadow.ray.org.y;
+		orgZ[i] = shadow.ray.org.z;
+		dirX[i] = shadow.ray.dir.x;
+		dirY[i] = shadow.ray.dir.y;
+		dirZ[i] = shadow.ray.dir.z;
+		maxDist[i] = shadow.maxDist;
+		lightR[i] = shadow.light.x;
+		lightG[i] = shadow.light.y;
+		lightB[i] = shadow.light.z;
+		slot[i] = s;
+	}
+};
+
+/**
+ * @brief Class rendering the independent paths of a tile as a wavefront: every path of
+ * the tile is generated at once, and every bounce runs as separate stages over queues of
+ * all live paths. Bin reorders the secondary rays by origin cell and direction octant,
+ * extend traces the ray queue into the hit queue, shade scatters the rays
+ * and queues their shadow rays, shadow tests those, and accumulate adds the light found
+ * to the paths. Each stage is a loop of one kind of work over arrays of its own, timed
+ * separately. The random numbers and the order of every sum match drawPixel() without
+ * mutations, so both render the same image as long as the compiler does not contract
+ * them into fused multiply-adds (-ffp-contract=off, or no -mfma / -march=native), which
+ * it does differently in the two loops. The MLT chains mutate one pixel's path after the
+ * other and stay with drawPixel().
+ *
+ */
+class Wavefront
+{
+public:
+	Wavefront()
+	{
+		resetStats();
+	}
+
+	Wavefront(const Wavefront&) = delete;
+	Wavefront& operator=(const Wavefront&) = delete;
+
+	/**
+	 * @brief Renders RenderConfig::samples paths for every pixel of the tile and adds
+	 * their average to the film. May run on several threads at once.
+	 *
+	 * @param tile Tile of pixels to render
+	 * @param imgWidth Width of the image
+	 * @param imgHeight Height of the image
+	 * @param film Film the estimates are added to
+	 * @param done Atomic int to track the number of pixels rendered
+	 * @param frame Index of the frame, together with the pixel it keys the random numbers
+	 * @param packets Trace the camera rays PACKET_SIZE at a time
+	 */
+	void renderTile(const Tile& tile, int imgWidth, int imgHeight, AccumFilm& film, std::atomic<int>& done, unsigned frame, bool packets);
+
+	/**
+	 * @brief Returns the seconds all threads spent in the stage since the last resetStats()
+	 *
+	 * @param stage One of the WAVE_ stages
+	 */
+	double stageTime(int stage) const;
+
+	/**
+	 * @brief Returns the name of the stage
+	 *
+	 */
+	static const char* stageName(int stage);
+
+	void resetStats();
+
+	/**
+	 * @brief Sets how many secondary rays are binned together before they are traced.
+	 * Rays leaving the same region in the same octant mostly visit the same BVH nodes,
+	 * so tracing them back to back keeps those nodes in cache. The binning does not
+	 * change the image.
+	 *
+	 * @param batch Rays sorted at a time, 0 traces them in queue order
+	 */
+	void setBinning(int batch)
+	{
+		binBatch = batch;
+	}
+
+	/**
+	 * @brief Sets whether the shade stage samples the scattered directions of all hits
+	 * at once with SampleLobes(), grouped by material and lobe, instead of one hit at a
+	 * time. Its polynomials change the directions in the last bits, so the image only
+	 * matches drawPixel() statistically.
+	 *
+	 */
+	void setBatchShading(bool batched)
+	{
+		batchShade = batched;
+	}
+
+	/**
+	 * @brief Returns the fraction of secondary rays which hit the same primitive as the
+	 * ray traced right before them, a measure of how local the traversals are
+	 *
+	 * @param traced Order the rays were traced in if true, otherwise queue order
+	 */
+	double hitCoherence(bool traced) const;
+
+	/**
+	 * @brief Returns the number of secondary rays traced since the last resetStats()
+	 *
+	 */
+	long long secondaryRays() const
+	{
+		return numSecondary;
+	}
+
+private:
+	int binBatch = 0;
+	bool batchShade = false;
+	std::atomic<long long> stageNs[WAVE_STAGES];
+	std::atomic<long long> numSecondary;
+	std::atomic<long long> sameHitQueue;
+	std::atomic<long long> sameHitTraced;
+};